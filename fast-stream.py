@@ -13,6 +13,7 @@ import threading
 import time
 import signal
 import sys
+import collections
  
 errorflg= False
 intrflg= False
@@ -32,6 +33,10 @@ parser.add_argument('device',
         help='Smoothie Serial Device')
 parser.add_argument('-q','--quiet',action='store_true', default=False,
         help='suppress output text')
+parser.add_argument('-p','--pack',action='store_true', default=False,
+        help='pack the stream with MeatPack to send fewer bytes')
+parser.add_argument('-c','--count',action='store_true', default=False,
+        help='count characters to keep the receive buffer full without overflowing it')
 args = parser.parse_args()
 
 f = args.gcode_file
@@ -47,6 +52,60 @@ s.flushInput()  # Flush startup text in serial input
 
 print("Streaming " + args.gcode_file.name + " to " + args.device)
 
+# MeatPack codes for the most common characters, anything else is sent as a whole byte after code 15
+MEATPACK= {c: i for i, c in enumerate('0123456789. \nGX')}
+MEATPACK_NO_SPACES= {c: i for i, c in enumerate('0123456789.E\nGX')}
+
+def pack(line):
+    """pack a line for M860 S2, spaces are left out and two characters go in each byte"""
+    chars= line.replace(' ', '') + '\n'
+    out= bytearray()
+    for i in range(0, len(chars), 2):
+        pair= chars[i:i + 2]
+        codes= [MEATPACK_NO_SPACES.get(c, 15) for c in pair]
+        if len(codes) == 1:
+            codes.append(0) # only after a newline, which ends the line
+        out.append(codes[0] | (codes[1] << 4))
+        for c, code in zip(pair, codes):
+            if code == 15:
+                out += c.encode('latin1')
+    return bytes(out)
+
+if args.pack:
+    # switch to packed mode, the ok must be seen before sending anything packed
+    s.write(b'M860 S2\n')
+    while True:
+        rep= s.readline()
+        if "error" in rep:
+            print("Packing not supported: " + rep)
+            sys.exit(1)
+        if rep.startswith("ok"):
+            break
+
+def command(cmd):
+    """send a command before streaming starts and return the lines upto its ok"""
+    s.write(pack(cmd) if args.pack else cmd + '\n')
+    lines= []
+    while True:
+        rep= s.readline()
+        if rep.startswith("ok"):
+            return lines
+        lines.append(rep.strip())
+
+rx_size= 0
+if args.count:
+    # oks come as soon as each line is received, so keep upto rx_size characters in flight
+    for rep in command('M861 S1'):
+        if rep.startswith("rx_buffer:"):
+            rx_size= int(rep[10:])
+    if rx_size == 0:
+        print("Character counting not supported")
+        sys.exit(1)
+
+inflight= collections.deque()
+inflight_lock= threading.Lock()
+inflight_chars= 0
+
 okcnt= 0
 
 def read_thread():
@@ -63,6 +122,12 @@ def read_thread():
                 break
         else :
             okcnt += n
+            if rx_size > 0:
+                global inflight_chars
+                with inflight_lock:
+                    for i in range(n):
+                        if inflight:
+                            inflight_chars -= inflight.popleft()
 
     print("Read thread exited")
     return
@@ -81,7 +146,20 @@ try:
         if line.startswith(';') :
             continue
         l= line.strip()
-        s.write(l + '\n')
+        if not l :
+            continue
+        if rx_size > 0:
+            # what the line takes in the receive buffer, which holds it unpacked
+            size= len(l.replace(' ', '') if args.pack else l) + 1
+            while inflight_chars + size > rx_size and not errorflg:
+                time.sleep(0.001)
+            with inflight_lock:
+                inflight.append(size)
+                inflight_chars += size
+        if args.pack:
+            s.write(pack(l))
+        else:
+            s.write(l + '\n')
         linecnt+=1
         if verbose: print("SND " + str(linecnt) + ": " + line.strip() + " - " + str(okcnt))
         
@@ -0,0 +1,223 @@
+#!/usr/bin/env python
+"""\
+Tokenize a gcode file into the binary job format that Smoothie plays without parsing text.
+
+The words are split and the numbers are kept as mantissa and exponent the same way
+Gcode::prepare_cached_values() and parse_number() do it on the board, so the values
+played are identical to those of the text file. Only plain G and M codes are tokenized,
+anything that needs the special handling in GcodeDispatch is kept as a text line.
+"""
+
+from __future__ import print_function
+import sys
+import argparse
+import struct
+
+MAGIC = b'SBG1'
+MAX_WORDS = 16
+MAX_LINE = 128
+
+# M codes that only use their letter/value words, anything else (filenames, messages etc) stays as text
+TOKENIZED_MCODES = set([3, 4, 5, 7, 8, 9, 17, 18, 82, 83, 84, 104, 106, 107, 109, 140, 141, 190, 191, 204, 205, 220, 221, 400])
+
+# values that are not exactly representable as a float would read differently with get_int() so stay as text
+MAX_EXACT = 1 << 24
+
+parser = argparse.ArgumentParser(description='Tokenize a gcode file for fast playing on Smoothie.')
+parser.add_argument('infile', type=argparse.FileType('r'),
+        help='gcode file to convert')
+parser.add_argument('outfile',
+        help='binary file to write, play it like any other file')
+parser.add_argument('-q','--quiet',action='store_true',
+        help='suppress all output to terminal')
+
+args = parser.parse_args()
+
+
+def parse_number(s, i):
+    """ mirrors parse_number() in Gcode.cpp, returns (mantissa, exponent, end) or None if there is no number at i """
+    j = i
+    while j < len(s) and s[j] in ' \t\r\n':
+        j += 1
+
+    neg = False
+    if j < len(s) and s[j] in '+-':
+        neg = s[j] == '-'
+        j += 1
+
+    mantissa = 0
+    exponent = 0
+    digits = False
+    while j < len(s) and s[j].isdigit():
+        digits = True
+        if mantissa < 100000000:
+            mantissa = mantissa * 10 + int(s[j])
+        else:
+            exponent += 1
+        j += 1
+
+    if j < len(s) and s[j] == '.':
+        j += 1
+        while j < len(s) and s[j].isdigit():
+            digits = True
+            if mantissa < 100000000:
+                mantissa = mantissa * 10 + int(s[j])
+                exponent -= 1
+            j += 1
+
+    if not digits:
+        return None
+
+    return (-mantissa if neg else mantissa, exponent, j)
+
+
+def parse_uint(s, i):
+    """ mirrors parse_uint() in Gcode.cpp """
+    while i < len(s) and s[i] in ' \t\r\n':
+        i += 1
+    v = 0
+    while i < len(s) and s[i].isdigit():
+        v = v * 10 + int(s[i])
+        i += 1
+    return (v, i)
+
+
+def varint(v):
+    z = (v << 1) ^ (v >> 31)
+    out = bytearray()
+    while True:
+        b = z & 0x7F
+        z >>= 7
+        if z:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def tokenize(cmd):
+    """ returns the record for a single command, or None if it has to stay as text """
+    words = []
+    i = 0
+    while i < len(cmd):
+        c = cmd[i]
+        if ('A' <= c <= 'Z') or c == '*':
+            n = parse_number(cmd, i + 1)
+            if n is None:
+                words.append((c, None, i, i + 1))
+                i += 1
+            else:
+                words.append((c, n[:2], i, n[2]))
+                i = n[2]
+        else:
+            i += 1
+
+    if len(words) > MAX_WORDS or not words or words[0][0] not in 'GM' or words[0][1] is None:
+        return None
+
+    op = words[0][0]
+    code, p = parse_uint(cmd, words[0][2] + 1)
+    subcode = 0
+    if p < len(cmd) and cmd[p] == '.':
+        subcode, p = parse_uint(cmd, p + 1)
+
+    if op == 'G' and code == 53:
+        return None
+    if op == 'M' and code not in TOKENIZED_MCODES:
+        return None
+    if code > 0xFFFF or subcode > 7:
+        return None
+
+    # the words after the code, like the stripped command on the board
+    rest = [w for w in words if w[2] >= p]
+    if any(w[0] in 'GM' for w in rest):
+        return None
+
+    rec = bytearray(op.encode('ascii'))
+    rec += struct.pack('<HBB', code, subcode, len(rest))
+    for letter, value, _, _ in rest:
+        if value is None:
+            rec += struct.pack('<cb', letter.encode('ascii'), -128)
+        else:
+            mantissa, exponent = value
+            if abs(mantissa) >= MAX_EXACT and exponent >= 0:
+                return None
+            if exponent < -127 or exponent > 127:
+                return None
+            rec += struct.pack('<cb', letter.encode('ascii'), exponent)
+            rec += varint(mantissa)
+
+    return bytes(rec)
+
+
+def split_commands(line):
+    """ split a line into single commands the same way GcodeDispatch does """
+    cmds = []
+    begin = 0
+    while begin < len(line):
+        end = len(line)
+        if len(line) - begin > 2:
+            for k in range(begin + 2, len(line)):
+                if line[k] in 'GM':
+                    end = k
+                    break
+        cmds.append(line[begin:end])
+        begin = end
+    return cmds
+
+
+def convert_line(line):
+    """ returns the records for one line of the file """
+    # remove comments and anything that is not part of the command
+    for c in ';(':
+        k = line.find(c)
+        if k >= 0:
+            line = line[:k]
+    line = line.strip()
+    if not line:
+        return b''
+
+    recs = None
+    if line[0] in 'GM':
+        recs = []
+        for cmd in split_commands(line):
+            rec = tokenize(cmd)
+            if rec is None:
+                recs = None
+                break
+            recs.append(rec)
+
+    if recs is not None:
+        return b''.join(recs)
+
+    # keep the whole line as text so the line based handling in GcodeDispatch still works
+    text = (line + '\n').encode('ascii', 'replace')
+    if len(text) > MAX_LINE:
+        raise ValueError('line too long')
+    return b'L' + struct.pack('<B', len(text)) + text
+
+
+lines = 0
+tokenized = 0
+insize = 0
+with open(args.outfile, 'wb') as out:
+    out.write(MAGIC)
+    outsize = len(MAGIC)
+    for n, line in enumerate(args.infile):
+        insize += len(line)
+        try:
+            rec = convert_line(line)
+        except ValueError as e:
+            if not args.quiet:
+                print("Warning: line {} discarded, {}".format(n + 1, e), file=sys.stderr)
+            continue
+
+        if rec:
+            lines += 1
+            if rec[0:1] != b'L':
+                tokenized += 1
+            out.write(rec)
+            outsize += len(rec)
+
+if not args.quiet:
+    print("{} lines, {} tokenized, {} bytes in {} bytes out".format(lines, tokenized, insize, outsize))
@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+"""\
+Upload a file to Smoothie over the USB serial connection using the bupload binary protocol
+
+Packets are CRC checked and several are kept in flight, so this is much faster than upload
+and any file can be sent, not only text.
+"""
+
+from __future__ import print_function
+import sys
+import argparse
+import serial
+import struct
+import zlib
+import time
+import os
+
+STX = 0x02
+
+parser = argparse.ArgumentParser(description='Upload a file to Smoothie over USB serial.')
+parser.add_argument('file', type=argparse.FileType('rb'),
+        help='filename to be uploaded')
+parser.add_argument('device',
+        help='Smoothie Serial Device')
+parser.add_argument('-o','--output',
+        help='Set output filename')
+parser.add_argument('-v','--verbose',action='store_true',
+        help='Show acknowledgements')
+parser.add_argument('-q','--quiet',action='store_true',
+        help='suppress all output to terminal')
+
+args = parser.parse_args()
+
+output = args.output
+if output == None :
+    output= os.path.basename(args.file.name)
+
+data = args.file.read()
+args.file.close()
+
+if not args.quiet : print("Uploading " + args.file.name + " to " + args.device + " as /sd/" + output + " size: " + str(len(data)))
+
+s = serial.Serial(args.device, 115200, timeout=10)
+s.flushInput()
+
+def readline():
+    ln = s.readline().decode('ascii', 'replace').strip()
+    if not ln:
+        print("Timed out waiting for Smoothie")
+        sys.exit(1)
+    if args.verbose: print("RSP: " + ln)
+    return ln
+
+s.write(("bupload /sd/" + output + "\n").encode('ascii'))
+while True:
+    ln = readline()
+    if ln.startswith("ready"):
+        break
+    if "fail" in ln or "not" in ln or "error" in ln:
+        print("Failed to start upload: " + ln)
+        sys.exit(1)
+
+_, max_data, window = ln.split()
+max_data = int(max_data)
+window = int(window)
+
+chunks = [data[i:i + max_data] for i in range(0, len(data), max_data)]
+chunks.append(b'') # the end of the file
+
+def packet(n):
+    body = struct.pack('<BH', n & 0xFF, len(chunks[n])) + chunks[n]
+    return bytes(bytearray([STX])) + body + struct.pack('<I', zlib.crc32(body) & 0xFFFFFFFF)
+
+base = 0 # oldest packet not acknowledged
+nxt = 0  # next packet to send
+start = time.time()
+while base < len(chunks):
+    while nxt < len(chunks) and nxt - base < window:
+        s.write(packet(nxt))
+        nxt += 1
+
+    ln = readline()
+    if ln.startswith("ack"):
+        seq = int(ln.split()[1])
+        # the sequence is 8 bits, find which outstanding packet it is
+        for n in range(base, nxt):
+            if n & 0xFF == seq:
+                base = n + 1
+                break
+        if not args.quiet and not args.verbose:
+            print(str(min(base * max_data, len(data))) + "/" + str(len(data)) + "\r", end='')
+            sys.stdout.flush()
+
+    elif ln.startswith("nak"):
+        seq = int(ln.split()[1])
+        for n in range(base, nxt + 1):
+            if n & 0xFF == seq:
+                nxt = n
+                break
+
+    elif ln.startswith("error"):
+        print("\n" + ln)
+        sys.exit(1)
+
+ln = readline()
+s.close()
+if not ln.startswith("uploaded"):
+    print("\nFailed: " + ln)
+    sys.exit(1)
+
+if not args.quiet:
+    secs = time.time() - start
+    print("\nUpload complete in {:.1f}s, {:.0f} bytes/s".format(secs, len(data) / max(secs, 0.001)))
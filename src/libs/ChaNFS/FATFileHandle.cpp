@@ -30,13 +30,19 @@ static const char *FR_ERRORS[] = {
 };
 #endif
 
+// number of DWORDs in a link map, enough for a file in 15 fragments
+#define LINK_MAP_SIZE 32
+
 FATFileHandle::FATFileHandle(FIL_t fh) {
     _fh = fh;
+    _link_map = NULL;
+    _no_link_map = false;
 }
     
 int FATFileHandle::close() {
     FFSDEBUG("close\n");
     int retval = f_close(&_fh);
+    delete [] _link_map;
     delete this;
     return retval;
 }
@@ -74,6 +80,10 @@ off_t FATFileHandle::lseek(off_t position, int whence) {
     } else if(whence==SEEK_CUR) {
         position += _fh.fptr;
     }
+    // with a link map a seek does not have to follow the FAT chain from the start of the file
+    if(_link_map == NULL && !_no_link_map) {
+        create_link_map();
+    }
     FRESULT res = f_lseek(&_fh, position);
     if(res) {
         FFSDEBUG("lseek failed (%d, %s)\n", res, FR_ERRORS[res]);
@@ -84,6 +94,26 @@ off_t FATFileHandle::lseek(off_t position, int whence) {
     }
 }
         
+// only for read only files that span more than one cluster, the map does not follow a file that grows
+void FATFileHandle::create_link_map() {
+    _no_link_map = true;
+    if((_fh.flag & FA_WRITE) || _fh.fsize <= (DWORD)_fh.fs->csize * _MAX_SS) {
+        return;
+    }
+
+    _link_map = new DWORD[LINK_MAP_SIZE];
+    _link_map[0] = LINK_MAP_SIZE;
+    _fh.cltbl = _link_map;
+    if(f_lseek(&_fh, CREATE_LINKMAP) != FR_OK) {
+        FFSDEBUG("no link map, file is too fragmented\n");
+        _fh.cltbl = NULL;
+        delete [] _link_map;
+        _link_map = NULL;
+        return;
+    }
+    _no_link_map = false;
+}
+
 int FATFileHandle::fsync() {
     FFSDEBUG("fsync()\n");
     FRESULT res = f_sync(&_fh);
@@ -24,7 +24,11 @@ public:
 
 protected:
 
+    void create_link_map();
+
     FIL_t _fh;
+    DWORD *_link_map;    // cluster link map for fast seeks in read only files
+    bool _no_link_map;   // set if the file is too fragmented for the map
 
 };
 
@@ -0,0 +1,42 @@
+#include "CountingStream.h"
+
+#include <string>
+#include <strings.h>
+
+int CountingStream::puts(const char *str)
+{
+    int len= strlen(str);
+    const char *p= str;
+
+    while(*p) {
+        if(drop_nl) {
+            while(*p == '\r' || *p == '\n') ++p;
+            if(*p == '\0') break;
+            drop_nl= false;
+            line_start= true;
+        }
+
+        if(line_start) {
+            if(strncmp(p, "ok", 2) == 0 && (p[2] == '\0' || p[2] == ' ' || p[2] == '\r' || p[2] == '\n')) {
+                // anything after the ok is still sent, like the temperatures from M105
+                p += 2;
+                if(*p == ' ') ++p;
+                if(*p == '\0' || *p == '\r' || *p == '\n') {
+                    drop_nl= true;
+                    continue;
+                }
+
+            } else if(strncmp(p, "!!", 2) == 0 || strncasecmp(p, "error", 5) == 0) {
+                stream->printf("line %lu: ", line);
+            }
+        }
+
+        const char *nl= strchr(p, '\n');
+        size_t n= nl != nullptr ? nl - p + 1 : strlen(p);
+        stream->puts(std::string(p, n).c_str());
+        line_start= nl != nullptr;
+        p += n;
+    }
+
+    return len;
+}
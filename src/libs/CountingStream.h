@@ -0,0 +1,28 @@
+#ifndef _COUNTINGSTREAM_H_
+#define _COUNTINGSTREAM_H_
+
+#include "StreamOutput.h"
+
+// Replies for lines from a stream in character counting mode go through this. The ok for a line was already sent
+// when it left the receive buffer, so the usual ok is dropped here and errors are tagged with the line number.
+class CountingStream : public StreamOutput {
+    public:
+        CountingStream(StreamOutput *s) : stream(s), line(0), line_start(true), drop_nl(false) {}
+        int puts(const char *str);
+        int _putc(int c) { return stream->_putc(c); }
+        int _getc(void) { return stream->_getc(); }
+        bool ready() { return stream->ready(); }
+        bool set_binary_mode(bool on) { return stream->set_binary_mode(on); }
+        bool set_packing(uint8_t mode) { return stream->set_packing(mode); }
+        int set_char_counting(bool on) { return stream->set_char_counting(on); }
+        void next_line() { ++line; }
+        void reset() { line= 0; line_start= true; drop_nl= false; }
+
+    private:
+        StreamOutput *stream;
+        unsigned long line;     // lines received since counting was turned on, the first is 1
+        bool line_start;
+        bool drop_nl;           // a bare ok was dropped, so is the newline after it
+};
+
+#endif
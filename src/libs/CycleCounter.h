@@ -0,0 +1,25 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "system_LPC17xx.h"
+#include <stdint.h>
+
+// The Cortex-M3 DWT cycle counter, used to time code for profiling.
+// It counts core clocks so it wraps every 42 seconds at 100MHz, only differences should be used.
+// The registers are accessed directly as the two CMSIS core headers in the tree do not agree on the DWT definitions
+static inline void enable_cycle_counter()
+{
+    *(volatile uint32_t *)0xE000EDFC |= (1 << 24); // CoreDebug DEMCR TRCENA
+    *(volatile uint32_t *)0xE0001000 |= 1;         // DWT CTRL CYCCNTENA
+}
+
+static inline uint32_t get_cycle_count() { return *(volatile uint32_t *)0xE0001004; } // DWT CYCCNT
+
+// convert a number of cycles to microseconds
+static inline uint32_t cycles_to_us(uint64_t cycles) { return cycles / (SystemCoreClock / 1000000); }
@@ -28,12 +28,17 @@
 #include "EndstopsPublicAccess.h"
 #include "Configurator.h"
 #include "SimpleShell.h"
+#include "Gcode.h"
+#include "CycleCounter.h"
+#include "us_ticker_api.h"
 
 #include "platform_memory.h"
+#include "utils.h"
 
 #include <malloc.h>
 #include <array>
 #include <string>
+#include <algorithm>
 
 #define baud_rate_setting_checksum CHECKSUM("baud_rate")
 #define uart0_checksum             CHECKSUM("uart0")
@@ -50,6 +55,7 @@ Kernel* Kernel::instance;
 Kernel::Kernel(){
     halted= false;
     feed_hold= false;
+    event_profiling= false;
 
     instance= this; // setup the Singleton instance of the kernel
 
@@ -163,6 +169,7 @@ Kernel::Kernel(){
 std::string Kernel::get_query_string()
 {
     std::string str;
+    str.reserve(80);
     bool homing;
     bool ok = PublicData::get_value(endstops_checksum, get_homing_status_checksum, 0, &homing);
     if(!ok) homing= false;
@@ -183,38 +190,33 @@ std::string Kernel::get_query_string()
         str.append("Run,");
     }
 
+    float mpos[3];
     if(running) {
-        float mpos[3];
         robot->get_current_machine_position(mpos);
         // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
         if(robot->compensationTransform) robot->compensationTransform(mpos, true); // get inverse compensation transform
 
-        char buf[128];
-        // machine position
-        size_t n= snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f,", robot->from_millimeters(mpos[0]), robot->from_millimeters(mpos[1]), robot->from_millimeters(mpos[2]));
-        str.append("MPos:").append(buf, n);
-
-        // work space position
-        Robot::wcs_t pos= robot->mcs2wcs(mpos);
-        n= snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(std::get<X_AXIS>(pos)), robot->from_millimeters(std::get<Y_AXIS>(pos)), robot->from_millimeters(std::get<Z_AXIS>(pos)));
-        str.append("WPos:").append(buf, n);
-        str.append(">\r\n");
-
     }else{
         // return the last milestone if idle
-        char buf[128];
-        // machine position
-        Robot::wcs_t mpos= robot->get_axis_position();
-        size_t n= snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f,", robot->from_millimeters(std::get<X_AXIS>(mpos)), robot->from_millimeters(std::get<Y_AXIS>(mpos)), robot->from_millimeters(std::get<Z_AXIS>(mpos)));
-        str.append("MPos:").append(buf, n);
-
-        // work space position
-        Robot::wcs_t pos= robot->mcs2wcs(mpos);
-        n= snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(std::get<X_AXIS>(pos)), robot->from_millimeters(std::get<Y_AXIS>(pos)), robot->from_millimeters(std::get<Z_AXIS>(pos)));
-        str.append("WPos:").append(buf, n);
-        str.append(">\r\n");
+        robot->get_axis_position(mpos);
+    }
 
+    // work space position
+    Robot::wcs_t pos= robot->mcs2wcs(mpos);
+    float wpos[3]= {std::get<X_AXIS>(pos), std::get<Y_AXIS>(pos), std::get<Z_AXIS>(pos)};
+    for (int i = 0; i < 3; ++i) {
+        mpos[i]= robot->from_millimeters(mpos[i]);
+        wpos[i]= robot->from_millimeters(wpos[i]);
     }
+
+    // this is polled several times a second so format without printf
+    char buf[128];
+    int n= format_floats(buf, sizeof(buf), mpos, 3);
+    str.append("MPos:").append(buf, n);
+    n= format_floats(buf, sizeof(buf), wpos, 3);
+    str.append(",WPos:").append(buf, n);
+    str.append(">\r\n");
+
     return str;
 }
 
@@ -226,6 +228,103 @@ void Kernel::add_module(Module* module){
 // Adds a hook for a given module and event
 void Kernel::register_for_event(_EVENT_ENUM id_event, Module *mod){
     this->hooks[id_event].push_back(mod);
+    if(id_event == ON_GCODE_RECEIVED) gcode_broadcast_order.push_back(gcode_module_order(mod));
+}
+
+// where a module comes in the order gcode handlers are called, the order in which modules first asked for gcodes
+uint16_t Kernel::gcode_module_order(Module *m)
+{
+    auto i= std::find(gcode_modules.begin(), gcode_modules.end(), m);
+    if(i != gcode_modules.end()) return i - gcode_modules.begin();
+    gcode_modules.push_back(m);
+    return gcode_modules.size() - 1;
+}
+
+static uint16_t gcode_hook_code(char letter, uint16_t code)
+{
+    return (letter == 'M' ? 0x8000 : 0) | (code & 0x7FFF);
+}
+
+// Adds a hook for a given module so it gets ON_GCODE_RECEIVED only for the given G or M code
+// modules that need to see every gcode register for ON_GCODE_RECEIVED instead
+void Kernel::register_for_gcode(char letter, uint16_t code, Module *mod){
+    uint16_t c= gcode_hook_code(letter, code);
+    uint16_t order= gcode_module_order(mod);
+    auto i= std::lower_bound(gcode_hooks.begin(), gcode_hooks.end(), c, [](const gcode_hook_t& h, uint16_t c) { return h.code < c; });
+    // keep module order within a code, and ignore duplicates
+    for (; i != gcode_hooks.end() && i->code == c && i->order <= order; ++i) {
+        if(i->module == mod) return;
+    }
+    gcode_hooks.insert(i, {c, mod, order});
+}
+
+// call the modules that broadcast for every gcode and the ones that registered for this code, all in module order so
+// modules that share a code (eg Robot and Extruder for G92) see it in the same order as when every module was broadcast to
+void Kernel::call_gcode_handlers(Gcode *gcode){
+    // M codes take precedence like they do in the handlers
+    bool routed= gcode->has_m || gcode->has_g;
+    uint16_t code= gcode->has_m ? gcode_hook_code('M', gcode->m) : gcode_hook_code('G', gcode->g);
+
+    size_t r= routed ? std::lower_bound(gcode_hooks.begin(), gcode_hooks.end(), code, [](const gcode_hook_t& h, uint16_t c) { return h.code < c; }) - gcode_hooks.begin() : gcode_hooks.size();
+    size_t b= 0;
+    const auto& broadcast= hooks[ON_GCODE_RECEIVED];
+    // indexed as a handler could add hooks
+    for (;;) {
+        bool more_routed= r < gcode_hooks.size() && gcode_hooks[r].code == code;
+        if(b < broadcast.size() && (!more_routed || gcode_broadcast_order[b] < gcode_hooks[r].order)) {
+            call_event_handler(ON_GCODE_RECEIVED, broadcast[b++], gcode);
+        } else if(more_routed) {
+            call_event_handler(ON_GCODE_RECEIVED, gcode_hooks[r++].module, gcode);
+        } else {
+            break;
+        }
+    }
+}
+
+inline void Kernel::call_event_handler(_EVENT_ENUM id_event, Module *m, void *argument)
+{
+    if(!event_profiling) {
+        (m->*kernel_callback_functions[id_event])(argument);
+        return;
+    }
+
+    // the time includes any events the handler calls itself
+    uint32_t start= get_cycle_count();
+    (m->*kernel_callback_functions[id_event])(argument);
+    add_event_profile(id_event, m, get_cycle_count() - start);
+}
+
+void Kernel::add_event_profile(_EVENT_ENUM id_event, Module *m, uint32_t cycles)
+{
+    // only a few modules per event so a linear search is fine, and it is outside the timed section
+    for (auto& p : event_profile[id_event]) {
+        if(p.module == m) {
+            p.calls++;
+            p.total_cycles += cycles;
+            if(cycles < p.min_cycles) p.min_cycles= cycles;
+            if(cycles > p.max_cycles) p.max_cycles= cycles;
+            return;
+        }
+    }
+    event_profile[id_event].push_back({m, 1, cycles, cycles, cycles});
+}
+
+void Kernel::enable_event_profiling(bool on)
+{
+    if(on && !event_profiling) {
+        enable_cycle_counter();
+        reset_event_profile();
+    }
+    event_profiling= on;
+}
+
+void Kernel::reset_event_profile()
+{
+    for (auto& v : event_profile) {
+        v.clear();
+        v.shrink_to_fit();
+    }
+    event_profile_start= us_ticker_read();
 }
 
 // Call a specific event with an argument
@@ -236,9 +335,15 @@ void Kernel::call_event(_EVENT_ENUM id_event, void * argument){
         was_idle= conveyor->is_idle(); // see if we were doing anything like printing
     }
 
-    // send to all registered modules
-    for (auto m : hooks[id_event]) {
-        (m->*kernel_callback_functions[id_event])(argument);
+    if(id_event == ON_GCODE_RECEIVED) {
+        // to the modules that want every gcode and the ones that registered for this specific code
+        call_gcode_handlers(static_cast<Gcode *>(argument));
+
+    } else {
+        // send to all registered modules
+        for (auto m : hooks[id_event]) {
+            call_event_handler(id_event, m, argument);
+        }
     }
 
     if(id_event == ON_HALT) {
@@ -257,13 +362,24 @@ bool Kernel::kernel_has_event(_EVENT_ENUM id_event, Module *mod)
     for (auto m : hooks[id_event]) {
         if(m == mod) return true;
     }
+    if(id_event == ON_GCODE_RECEIVED) {
+        for (auto& h : gcode_hooks) {
+            if(h.module == mod) return true;
+        }
+    }
     return false;
 }
 
 void Kernel::unregister_for_event(_EVENT_ENUM id_event, Module *mod)
 {
+    if(id_event == ON_GCODE_RECEIVED) {
+        // also remove any specific gcode hooks
+        gcode_hooks.erase(std::remove_if(gcode_hooks.begin(), gcode_hooks.end(), [mod](const gcode_hook_t& h) { return h.module == mod; }), gcode_hooks.end());
+    }
+
     for (auto i = hooks[id_event].begin(); i != hooks[id_event].end(); ++i) {
         if(*i == mod) {
+            if(id_event == ON_GCODE_RECEIVED) gcode_broadcast_order.erase(gcode_broadcast_order.begin() + (i - hooks[id_event].begin()));
             hooks[id_event].erase(i);
             return;
         }
@@ -32,6 +32,7 @@ class Adc;
 class PublicData;
 class SimpleShell;
 class Configurator;
+class Gcode;
 
 class Kernel {
     public:
@@ -41,11 +42,26 @@ class Kernel {
 
         void add_module(Module* module);
         void register_for_event(_EVENT_ENUM id_event, Module *module);
+        void register_for_gcode(char letter, uint16_t code, Module *module);
         void call_event(_EVENT_ENUM id_event, void * argument= nullptr);
 
         bool kernel_has_event(_EVENT_ENUM id_event, Module *module);
         void unregister_for_event(_EVENT_ENUM id_event, Module *module);
 
+        // optional timing of each module's event handlers, used by the top command
+        struct event_profile_t {
+            Module *module;
+            uint32_t calls;
+            uint32_t min_cycles;
+            uint32_t max_cycles;
+            uint64_t total_cycles;
+        };
+        void enable_event_profiling(bool on);
+        void reset_event_profile();
+        bool is_event_profiling() const { return event_profiling; }
+        const std::vector<event_profile_t>& get_event_profile(_EVENT_ENUM id_event) const { return event_profile[id_event]; }
+        uint32_t get_event_profile_start() const { return event_profile_start; }
+
         bool is_using_leds() const { return use_leds; }
         bool is_halted() const { return halted; }
         bool is_grbl_mode() const { return grbl_mode; }
@@ -76,12 +92,32 @@ class Kernel {
     private:
         // When a module asks to be called for a specific event ( a hook ), this is where that request is remembered
         std::array<std::vector<Module*>, NUMBER_OF_DEFINED_EVENTS> hooks;
+
+        // modules that only want specific G or M codes, sorted by code so ON_GCODE_RECEIVED can be routed rather than broadcast
+        struct gcode_hook_t {
+            uint16_t code; // M codes have the top bit set
+            Module *module;
+            uint16_t order; // index in gcode_modules
+        };
+        std::vector<gcode_hook_t> gcode_hooks;
+        // every module that asked for gcodes, routed or broadcast, in the order they first asked which is the order they were loaded,
+        // the handlers for a gcode are called in this order whichever way they registered
+        std::vector<Module*> gcode_modules;
+        std::vector<uint16_t> gcode_broadcast_order; // the gcode_modules index of each hooks[ON_GCODE_RECEIVED]
+        uint16_t gcode_module_order(Module *m);
+        void call_gcode_handlers(Gcode *gcode);
+        void call_event_handler(_EVENT_ENUM id_event, Module *m, void *argument);
+        void add_event_profile(_EVENT_ENUM id_event, Module *m, uint32_t cycles);
+
+        std::array<std::vector<event_profile_t>, NUMBER_OF_DEFINED_EVENTS> event_profile;
+        uint32_t event_profile_start; // us_ticker time of the last reset
         struct {
             bool use_leds:1;
             bool halted:1;
             bool grbl_mode:1;
             bool feed_hold:1;
             bool ok_per_line:1;
+            bool event_profiling:1;
         };
 
 };
@@ -0,0 +1,56 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeatPack.h"
+
+#define MEATPACK_FULL 0x0F
+
+static const char meatpack_table[15]= { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', ' ', '\n', 'G', 'X' };
+
+// called from the receive interrupts so keep it short
+int MeatPack::decode(uint8_t c, char out[2])
+{
+    if(mode == OFF) {
+        out[0]= c;
+        return 1;
+    }
+
+    if(full_count > 0) {
+        // a whole character, then the packed one that was waiting for it
+        int n= 0;
+        out[n++]= c;
+        if(deferred != 0) {
+            out[n++]= deferred;
+            deferred= 0;
+        }
+        --full_count;
+        return n;
+    }
+
+    uint8_t lo= c & 0x0F, hi= c >> 4;
+    // without spaces the space code is used for E
+    char first= (lo == 11 && mode == PACKED_NO_SPACES) ? 'E' : meatpack_table[lo < MEATPACK_FULL ? lo : 0];
+    char second= (hi == 11 && mode == PACKED_NO_SPACES) ? 'E' : meatpack_table[hi < MEATPACK_FULL ? hi : 0];
+
+    if(lo == MEATPACK_FULL) {
+        full_count= (hi == MEATPACK_FULL) ? 2 : 1;
+        if(hi != MEATPACK_FULL) deferred= second;
+        return 0;
+    }
+
+    out[0]= first;
+    // a newline ends the line so the other half is only padding
+    if(first == '\n') return 1;
+
+    if(hi == MEATPACK_FULL) {
+        full_count= 1;
+        return 1;
+    }
+
+    out[1]= second;
+    return 2;
+}
@@ -0,0 +1,29 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Decodes a MeatPack packed stream, each byte holds two of the 15 most common gcode characters as 4 bit codes,
+// code 15 means the character follows as a whole byte. Enabled per stream with M860, see fast-stream.py for the encoder
+class MeatPack {
+    public:
+        enum MODE { OFF= 0, PACKED= 1, PACKED_NO_SPACES= 2 };
+
+        MeatPack() { set_mode(OFF); }
+        void set_mode(uint8_t m) { mode= m; full_count= 0; deferred= 0; }
+        uint8_t get_mode() const { return mode; }
+
+        // decode one received byte into out, returns how many characters it gave, 0 to 2
+        int decode(uint8_t c, char out[2]);
+
+    private:
+        uint8_t mode;
+        uint8_t full_count; // whole characters still to come for the last packed byte
+        char deferred;      // second character of a packed byte whose first one comes as a whole byte
+};
@@ -32,3 +32,9 @@ void Module::register_for_event(_EVENT_ENUM event_id){
     // You add things to Smoothie by making a new class that inherits the Module class. See http://smoothieware.org/moduleexample for a crude introduction
     THEKERNEL->register_for_event(event_id, this);
 }
+
+void Module::register_for_gcode(char letter, uint16_t code){
+    // Modules that only handle a few G or M codes register for those codes, then the kernel only calls them for those
+    // rather than every module checking every gcode, the letter is 'G' or 'M'
+    THEKERNEL->register_for_gcode(letter, code, this);
+}
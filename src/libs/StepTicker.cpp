@@ -15,10 +15,13 @@
 #include "StreamOutputPool.h"
 #include "Block.h"
 #include "Conveyor.h"
+#include "StreamOutput.h"
+#include "CycleCounter.h"
 
 #include "system_LPC17xx.h" // mbed.h lib
 #include <math.h>
 #include <mri.h>
+#include <string.h>
 
 #ifdef STEPTICKER_DEBUG_PIN
 // debug pins, only used if defined in src/makefile
@@ -53,6 +56,7 @@ StepTicker::StepTicker()
     this->num_motors = 0;
 
     this->running = false;
+    this->isr_profiling = false;
     this->current_block = nullptr;
 
     #ifdef STEPTICKER_DEBUG_PIN
@@ -107,20 +111,125 @@ void StepTicker::unstep_tick()
 extern "C" void TIMER1_IRQHandler (void)
 {
     LPC_TIM1->IR |= 1 << 0;
-    StepTicker::getInstance()->unstep_tick();
+    StepTicker *st= StepTicker::getInstance();
+    if(st->is_isr_profiling()) {
+        uint32_t start= get_cycle_count();
+        st->unstep_tick();
+        st->add_isr_profile(StepTicker::UNSTEP_ISR, get_cycle_count() - start);
+    }else{
+        st->unstep_tick();
+    }
 }
 
 // The actual interrupt handler where we do all the work
 extern "C" void TIMER0_IRQHandler (void)
 {
+    // the timer resets on match so its count is how long it took us to get here
+    uint32_t tc= LPC_TIM0->TC;
     // Reset interrupt register
     LPC_TIM0->IR |= 1 << 0;
-    StepTicker::getInstance()->step_tick();
+    StepTicker *st= StepTicker::getInstance();
+    if(st->is_isr_profiling()) {
+        uint32_t start= get_cycle_count();
+        st->step_tick();
+        // includes any time the unstep interrupt took as it has a higher priority
+        st->add_isr_profile(StepTicker::STEP_ISR, get_cycle_count() - start);
+        st->add_step_latency(tc);
+    }else{
+        st->step_tick();
+    }
 }
 
 extern "C" void PendSV_Handler(void)
 {
-    StepTicker::getInstance()->handle_finish();
+    StepTicker *st= StepTicker::getInstance();
+    if(st->is_isr_profiling()) {
+        uint32_t start= get_cycle_count();
+        st->handle_finish();
+        st->add_isr_profile(StepTicker::PENDSV_ISR, get_cycle_count() - start);
+    }else{
+        st->handle_finish();
+    }
+}
+
+void StepTicker::enable_isr_profiling(bool on)
+{
+    if(on && isr_profile == nullptr) {
+        // only pay for the memory if it is used
+        isr_profile= new isr_profile_t[NUMBER_OF_ISRS];
+        step_latency= new uint32_t[STEPTICKER_LATENCY_BUCKETS];
+    }
+    if(on && !isr_profiling) {
+        enable_cycle_counter();
+        reset_isr_profile();
+    }
+    isr_profiling= on;
+}
+
+void StepTicker::reset_isr_profile()
+{
+    if(isr_profile == nullptr) return;
+    __disable_irq();
+    memset(isr_profile, 0, sizeof(isr_profile_t) * NUMBER_OF_ISRS);
+    memset(step_latency, 0, sizeof(uint32_t) * STEPTICKER_LATENCY_BUCKETS);
+    __enable_irq();
+}
+
+// called from the ISRs, keep it short
+void StepTicker::add_isr_profile(ISR_ENUM isr, uint32_t cycles)
+{
+    isr_profile_t& p= isr_profile[isr];
+    p.count++;
+    p.total_cycles += cycles;
+    if(cycles > p.max_cycles) p.max_cycles= cycles;
+
+    // the timer runs at a quarter of the core clock
+    uint32_t b= (cycles * 10) / (period * 4);
+    if(b >= STEPTICKER_ISR_BUCKETS) b= STEPTICKER_ISR_BUCKETS - 1;
+    p.histogram[b]++;
+}
+
+void StepTicker::add_step_latency(uint32_t timer_count)
+{
+    uint32_t b= timer_count / (SystemCoreClock / 4000000); // in us
+    if(b >= STEPTICKER_LATENCY_BUCKETS) b= STEPTICKER_LATENCY_BUCKETS - 1;
+    step_latency[b]++;
+}
+
+void StepTicker::dump_isr_profile(StreamOutput *stream) const
+{
+    static const char *isr_names[NUMBER_OF_ISRS]= {"step", "unstep", "pendsv"};
+    uint32_t period_cycles= period * 4;
+
+    // copy so the interrupts do not change it while we print
+    isr_profile_t p[NUMBER_OF_ISRS];
+    uint32_t latency[STEPTICKER_LATENCY_BUCKETS];
+    __disable_irq();
+    memcpy(p, isr_profile, sizeof(p));
+    memcpy(latency, step_latency, sizeof(latency));
+    __enable_irq();
+
+    // every step tick is one period, so that is the elapsed time
+    uint64_t elapsed= (uint64_t)p[STEP_ISR].count * period_cycles;
+    stream->printf("step period %lu cycles, %lu ticks\n", period_cycles, p[STEP_ISR].count);
+    for (int i = 0; i < NUMBER_OF_ISRS; ++i) {
+        uint32_t avg= p[i].count > 0 ? p[i].total_cycles / p[i].count : 0;
+        stream->printf("%-6s: calls %lu, avg %lu, max %lu cycles (%1.1f%% of period), load %1.2f%%\n", isr_names[i],
+            p[i].count, avg, p[i].max_cycles, 100.0F * p[i].max_cycles / period_cycles,
+            elapsed > 0 ? 100.0F * p[i].total_cycles / elapsed : 0.0F);
+
+        stream->printf("   %% of period:");
+        for (int b = 0; b < STEPTICKER_ISR_BUCKETS; ++b) {
+            stream->printf(" %s%d:%lu", b == STEPTICKER_ISR_BUCKETS - 1 ? ">=" : "<", (b + 1) * 10 > 100 ? 100 : (b + 1) * 10, p[i].histogram[b]);
+        }
+        stream->printf("\n");
+    }
+
+    stream->printf("step latency us:");
+    for (int b = 0; b < STEPTICKER_LATENCY_BUCKETS; ++b) {
+        stream->printf(" %s%d:%lu", b == STEPTICKER_LATENCY_BUCKETS - 1 ? ">=" : "<", b == STEPTICKER_LATENCY_BUCKETS - 1 ? b : b + 1, latency[b]);
+    }
+    stream->printf("\n");
 }
 
 // slightly lower priority than TIMER0, the whole end of block/start of block is done here allowing the timer to continue ticking
@@ -208,6 +317,9 @@ void StepTicker::step_tick (void)
     // do this after so we start at tick 0
     current_tick++; // count number of ticks
 
+    // a dwell has no motors to move, it just lasts for its ticks
+    if(current_block->is_dwell && current_tick < current_block->total_move_ticks) still_moving= true;
+
     // We may have set a pin on in this tick, now we reset the timer to set it off
     // Note there could be a race here if we run another tick before the unsteps have happened,
     // right now it takes about 3-4us but if the unstep were near 10uS or greater it would be an issue
@@ -264,7 +376,8 @@ bool StepTicker::start_next_block()
 
     current_tick= 0;
 
-    if(ok) {
+    // a dwell moves no motors but still has to run for its ticks
+    if(ok || current_block->is_dwell) {
         //SET_STEPTICKER_DEBUG_PIN(1);
         return true;
 
@@ -20,11 +20,17 @@
 
 class StepperMotor;
 class Block;
+class StreamOutput;
 
 // handle 2.62 Fixed point
 #define STEPTICKER_FPSCALE (1LL<<62)
 #define STEPTICKER_FROMFP(x) ((float)(x)/STEPTICKER_FPSCALE)
 
+// ISR time histogram buckets are 10% of the step period each, the last one counts overruns
+#define STEPTICKER_ISR_BUCKETS 11
+// step tick latency buckets are 1us each, the last one is everything above
+#define STEPTICKER_LATENCY_BUCKETS 8
+
 class StepTicker{
     public:
         StepTicker();
@@ -45,6 +51,15 @@ class StepTicker{
 
         static StepTicker *getInstance() { return instance; }
 
+        // optional timing of the step tick, unstep and PendSV interrupts
+        enum ISR_ENUM { STEP_ISR, UNSTEP_ISR, PENDSV_ISR, NUMBER_OF_ISRS };
+        void enable_isr_profiling(bool on);
+        void reset_isr_profile();
+        bool is_isr_profiling() const { return isr_profiling; }
+        void add_isr_profile(ISR_ENUM isr, uint32_t cycles);
+        void add_step_latency(uint32_t timer_count);
+        void dump_isr_profile(StreamOutput *stream) const;
+
     private:
         static StepTicker *instance;
 
@@ -58,6 +73,18 @@ class StepTicker{
         Block *current_block;
         uint32_t current_tick{0};
 
+        struct isr_profile_t {
+            uint32_t count;
+            uint32_t max_cycles;
+            uint64_t total_cycles;
+            uint32_t histogram[STEPTICKER_ISR_BUCKETS];
+        };
+        isr_profile_t *isr_profile{nullptr}; // allocated when profiling is first enabled
+        uint32_t *step_latency{nullptr};     // STEPTICKER_LATENCY_BUCKETS step tick entry latencies
+
+        // not in the bitfield below as it is set from the main loop while running is changed by the interrupts
+        volatile bool isr_profiling;
+
         struct {
             volatile bool running:1;
             uint8_t num_motors:4;
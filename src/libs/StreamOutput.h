@@ -11,6 +11,7 @@
 #include <cstdarg>
 #include <cstring>
 #include <stdio.h>
+#include <stdint.h>
 
 // This is a base class for all StreamOutput objects.
 // StreamOutputs are basically "things you can sent strings to". They are passed along with gcodes for example so modules can answer to those gcodes.
@@ -28,6 +29,13 @@ class StreamOutput {
         virtual int _getc(void) { return 0; }
         virtual int puts(const char* str) = 0;
         virtual bool ready() { return true; };
+        // receive every byte as is, without line handling or realtime characters like ^X, false if the stream can not
+        virtual bool set_binary_mode(bool on) { return false; }
+        // decode what is received with MeatPack::MODE, false if the stream can not
+        virtual bool set_packing(uint8_t mode) { return false; }
+        // send the ok for a line as soon as it leaves the receive buffer, returns the size of that buffer for the host to
+        // count characters against, 0 if the stream can not
+        virtual int set_char_counting(bool on) { return 0; }
 
         static NullStreamOutput NullStream;
 };
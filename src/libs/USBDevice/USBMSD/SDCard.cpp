@@ -64,10 +64,11 @@
  * just always use the Standard Capacity cards with a block size of 512 bytes.
  * This is set with CMD16.
  *
- * You can read and write single blocks (CMD17, CMD25) or multiple blocks
- * (CMD18, CMD25). For simplicity, I'll just use single block accesses. When
- * the card gets a read command, it responds with a response token, and then
- * a data token or an error.
+ * You can read and write single blocks (CMD17, CMD24) or multiple blocks
+ * (CMD18, CMD25). Single sectors use the single block commands, runs of
+ * sectors requested by FatFs use the multiple block ones so the card only
+ * has to find the first one. When the card gets a read command, it responds
+ * with a response token, and then a data token or an error.
  *
  * SPI Command Format
  * ------------------
@@ -125,6 +126,12 @@
 static const uint8_t OXFF = 0xFF;
 
 #define SD_COMMAND_TIMEOUT 5000
+// bytes to wait for a data token, at 2.5MHz this is about 300ms which is well over the worst case read latency
+#define SD_DATA_TIMEOUT 100000
+
+#define SD_TOKEN_START_BLOCK        0xFE
+#define SD_TOKEN_START_MULTI_WRITE  0xFC
+#define SD_TOKEN_STOP_MULTI_WRITE   0xFD
 
 SDCard::SDCard(PinName mosi, PinName miso, PinName sclk, PinName cs) :
   _spi(mosi, miso, sclk), _cs(cs) {
@@ -328,6 +335,95 @@ int SDCard::disk_read(char *buffer, uint32_t block_number)
     return 0;
 }
 
+int SDCard::disk_read_multi(char *buffer, uint32_t block_number, uint32_t count)
+{
+    if (count == 1)
+        return disk_read(buffer, block_number);
+
+    if (busyflag)
+        return 0;
+
+    if (cardtype == SDCARD_FAIL)
+        return -1;
+
+    busyflag = true;
+
+    // set read address for multiple blocks (CMD18), the card then sends blocks until told to stop
+    if(_cmdx(SDCMD_READ_MULTIPLE_BLOCK, BLOCK2ADDR(block_number)) != 0) {
+        // _cmdx leaves the card selected when it gets an error response
+        _cs = 1;
+        _spi.write(0xFF);
+        busyflag = false;
+        return 1;
+    }
+
+    int r = 0;
+    for (uint32_t i = 0; i < count && r == 0; i++) {
+        r = _read_data(buffer + (i << 9), 512);
+    }
+
+    // stop the transmission (CMD12), there is a stuff byte before its R1b response
+    _spi.write(0x40 | SDCMD_STOP_TRANSMISSION);
+    _spi.write(0x00);
+    _spi.write(0x00);
+    _spi.write(0x00);
+    _spi.write(0x00);
+    _spi.write(0x95);
+    _spi.write(0xFF);
+    for(int i=0; i<SD_COMMAND_TIMEOUT; i++) {
+        if(!(_spi.write(0xFF) & 0x80)) break;
+    }
+    _wait_not_busy();
+
+    _cs = 1;
+    _spi.write(0xFF);
+
+    busyflag = false;
+
+    return r;
+}
+
+int SDCard::disk_write_multi(const char *buffer, uint32_t block_number, uint32_t count)
+{
+    if (count == 1)
+        return disk_write(buffer, block_number);
+
+    if (busyflag)
+        return 0;
+
+    if (cardtype == SDCARD_FAIL)
+        return -1;
+
+    busyflag = true;
+
+    // set write address for multiple blocks (CMD25)
+    if(_cmdx(SDCMD_WRITE_MULTIPLE_BLOCK, BLOCK2ADDR(block_number)) != 0) {
+        // _cmdx leaves the card selected when it gets an error response
+        _cs = 1;
+        _spi.write(0xFF);
+        busyflag = false;
+        return 1;
+    }
+    _spi.write(0xFF);
+
+    int r = 0;
+    for (uint32_t i = 0; i < count && r == 0; i++) {
+        r = _write_data(SD_TOKEN_START_MULTI_WRITE, buffer + (i << 9), 512);
+    }
+
+    // the stop token ends the transfer, the card is then busy while it finishes programming
+    _spi.write(SD_TOKEN_STOP_MULTI_WRITE);
+    _spi.write(0xFF);
+    _wait_not_busy();
+
+    _cs = 1;
+    _spi.write(0xFF);
+
+    busyflag = false;
+
+    return r;
+}
+
 int SDCard::disk_status() { return (_sectors > 0)?0:1; }
 int SDCard::disk_sync() {
     // TODO: wait for DMA, wait for card not busy
@@ -509,6 +605,50 @@ int SDCard::_write(const char *buffer, int length) {
     return 0;
 }
 
+// read one data block with chip select already low, returns 1 if the card sent an error token or nothing
+int SDCard::_read_data(char *buffer, int length) {
+    int token = 0xFF;
+    for(int i=0; i<SD_DATA_TIMEOUT && token == 0xFF; i++) {
+        token = _spi.write(0xFF);
+    }
+    if(token != SD_TOKEN_START_BLOCK)
+        return 1;
+
+    for(int i=0; i<length; i++) {
+        buffer[i] = _spi.write(0xFF);
+    }
+    _spi.write(0xFF); // checksum
+    _spi.write(0xFF);
+    return 0;
+}
+
+// write one data block with chip select already low and wait for the card to take it
+int SDCard::_write_data(uint8_t token, const char *buffer, int length) {
+    _spi.write(token);
+
+    for(int i=0; i<length; i++) {
+        _spi.write(buffer[i]);
+    }
+
+    // write the checksum
+    _spi.write(0xFF);
+    _spi.write(0xFF);
+
+    // check the repsonse token
+    if((_spi.write(0xFF) & 0x1F) != 0x05)
+        return 1;
+
+    _wait_not_busy();
+    return 0;
+}
+
+// the card holds the data line low while it is busy
+void SDCard::_wait_not_busy() {
+    for(int i=0; i<SD_DATA_TIMEOUT; i++) {
+        if(_spi.write(0xFF) != 0) return;
+    }
+}
+
 static int ext_bits(char *data, int msb, int lsb) {
     int bits = 0;
     int size = 1 + msb - lsb;
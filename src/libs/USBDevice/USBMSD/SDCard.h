@@ -71,6 +71,8 @@ public:
     virtual int disk_initialize();
     virtual int disk_write(const char *buffer, uint32_t block_number);
     virtual int disk_read(char *buffer, uint32_t block_number);
+    virtual int disk_read_multi(char *buffer, uint32_t block_number, uint32_t count);
+    virtual int disk_write_multi(const char *buffer, uint32_t block_number, uint32_t count);
     virtual int disk_status();
     virtual int disk_sync();
     virtual uint32_t disk_sectors();
@@ -94,6 +96,9 @@ protected:
 
     int _read(char *buffer, int length);
     int _write(const char *buffer, int length);
+    int _read_data(char *buffer, int length);
+    int _write_data(uint8_t token, const char *buffer, int length);
+    void _wait_not_busy();
 
     uint32_t _sd_sectors();
     uint32_t _sectors;
@@ -23,6 +23,24 @@ public:
      */
     virtual int disk_write(const char * data, uint32_t block) { return 0; };
 
+    /*
+     * read or write count consecutive blocks, the default does them one at a time
+     *
+     * @returns 0 if successful
+     */
+    virtual int disk_read_multi(char * data, uint32_t block, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (disk_read(data + i * disk_blocksize(), block + i)) return 1;
+        }
+        return 0;
+    };
+    virtual int disk_write_multi(const char * data, uint32_t block, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (disk_write(data + i * disk_blocksize(), block + i)) return 1;
+        }
+        return 0;
+    };
+
     /*
      * Disk initilization
      */
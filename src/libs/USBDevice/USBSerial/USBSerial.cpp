@@ -30,15 +30,25 @@
 
 #define iprintf(...) do { } while (0)
 
-USBSerial::USBSerial(USB *u): USBCDC(u), rxbuf(256 + 8), txbuf(128 + 8)
+#define RX_BUFFER_SIZE (256 + 8)
+// complete lines dispatched per main loop, so a host streaming fast does not starve the other modules
+#define LINES_PER_LOOP 8
+
+USBSerial::USBSerial(USB *u): USBCDC(u), rxbuf(RX_BUFFER_SIZE), txbuf(128 + 8), counting(this)
 {
     usb = u;
+    // a line can not be longer than rxbuf
+    line_buf = (char *)AHB0.alloc(RX_BUFFER_SIZE);
+    if (line_buf == nullptr)
+        line_buf = new char[RX_BUFFER_SIZE];
     nl_in_rx = 0;
     attach = attached = false;
     flush_to_nl = false;
     halt_flag = false;
     query_flag = false;
     last_char_was_dollar = false;
+    binary_mode = false;
+    char_counting = false;
 }
 
 void USBSerial::ensure_tx_space(int space)
@@ -67,22 +77,60 @@ int USBSerial::_getc()
     uint8_t c = 0;
     setled(4, 1); while (rxbuf.isEmpty()); setled(4, 0);
     rxbuf.dequeue(&c);
-    if (rxbuf.free() == MAX_PACKET_SIZE_EPBULK) {
+    if (rxbuf.free() == rx_space()) {
         usb->endpointSetInterrupt(CDC_BulkOut.bEndpointAddress, true);
-        iprintf("rxbuf has room for another packet, interrupt enabled\n");
-    } else if ((rxbuf.free() < MAX_PACKET_SIZE_EPBULK) && (nl_in_rx == 0)) {
+    } else {
+        check_rx_deadlock();
+    }
+    if (nl_in_rx > 0)
+        if (c == '\n' || c == '\r')
+            nl_in_rx--;
+
+    return c;
+}
+
+void USBSerial::check_rx_deadlock()
+{
+    if ((rxbuf.free() < rx_space()) && (nl_in_rx == 0) && !binary_mode) {
         // handle potential deadlock where a short line, and the beginning of a very long line are bundled in one usb packet
         rxbuf.flush();
         flush_to_nl = true;
 
         usb->endpointSetInterrupt(CDC_BulkOut.bEndpointAddress, true);
-        iprintf("rxbuf has room for another packet, interrupt enabled\n");
     }
-    if (nl_in_rx > 0)
-        if (c == '\n' || c == '\r')
-            nl_in_rx--;
+}
 
-    return c;
+// move the next line from rxbuf into line_buf without its newline, returns -1 and leaves rxbuf alone if it holds no newline
+int USBSerial::read_line()
+{
+    int len = -1;
+    uint8_t c;
+    int n = rxbuf.available();
+    for (int i = 0; i < n; i++) {
+        rxbuf.peek(&c, i);
+        if (c == '\n' || c == '\r') {
+            len = i;
+            break;
+        }
+    }
+
+    if (len >= 0) {
+        for (int i = 0; i < len; i++)
+            rxbuf.dequeue((uint8_t *)&line_buf[i]);
+        rxbuf.dequeue(&c);
+        __disable_irq();
+        nl_in_rx--;
+        __enable_irq();
+    }
+
+    // there is room for another packet now, unless what is left is the start of a line too long for rxbuf
+    if (rxbuf.free() >= rx_space()) {
+        usb->endpointSetInterrupt(CDC_BulkOut.bEndpointAddress, true);
+    } else {
+        check_rx_deadlock();
+    }
+
+    return len;
 }
 
 int USBSerial::puts(const char *str)
@@ -156,6 +204,69 @@ bool USBSerial::USBEvent_EPIn(uint8_t bEP, uint8_t bEPStatus)
     return r;
 }
 
+// handle one received character, called in ISR context
+void USBSerial::receive_char(uint8_t c)
+{
+    // handle backspace and delete by deleting the last character in the buffer if there is one
+    if(c == 0x08 || c == 0x7F) {
+        if(!rxbuf.isEmpty()) rxbuf.pop();
+        return;
+    }
+
+    if(c == 'X' - 'A' + 1) { // ^X
+        //THEKERNEL->set_feed_hold(false); // required to free stuff up
+        halt_flag = true;
+        return;
+    }
+
+    if(c == '?') { // ?
+        query_flag = true;
+        return;
+    }
+
+    if(THEKERNEL->is_grbl_mode()) {
+        if(c == '!') { // safe pause
+            //THEKERNEL->set_feed_hold(true);
+            return;
+        }
+
+        if(c == '~') { // safe resume
+            //THEKERNEL->set_feed_hold(false);
+            return;
+        }
+        // if(last_char_was_dollar && (c == 'X' || c == 'H')) {
+        //     // we need to do this otherwise $X/$H won't work if there was a feed hold like when stop is clicked in bCNC
+        //     THEKERNEL->set_feed_hold(false);
+        // }
+    }
+
+    last_char_was_dollar = (c == '$');
+
+    if (flush_to_nl == false)
+        rxbuf.queue(c);
+
+    // if (c >= 32 && c < 128)
+    // {
+    //     iprintf("%c", c);
+    // }
+    // else
+    // {
+    //     iprintf("\\x%02X", c);
+    // }
+
+    if (c == '\n' || c == '\r') {
+        if (flush_to_nl)
+            flush_to_nl = false;
+        else
+            nl_in_rx++;
+    } else if (rxbuf.isFull() && (nl_in_rx == 0)) {
+        // to avoid a deadlock with very long lines, we must dump the buffer
+        // and continue flushing to the next newline
+        rxbuf.flush();
+        flush_to_nl = true;
+    }
+}
+
 bool USBSerial::USBEvent_EPOut(uint8_t bEP, uint8_t bEPStatus)
 {
     /*
@@ -164,11 +275,10 @@ bool USBSerial::USBEvent_EPOut(uint8_t bEP, uint8_t bEPStatus)
 
     bool r = true;
 
-    iprintf("USBSerial:EpOut\n");
     if (bEP != CDC_BulkOut.bEndpointAddress)
         return false;
 
-    if (rxbuf.free() < MAX_PACKET_SIZE_EPBULK) {
+    if (rxbuf.free() < rx_space()) {
 //         usb->endpointSetInterrupt(bEP, false);
         return false;
     }
@@ -178,75 +288,26 @@ bool USBSerial::USBEvent_EPOut(uint8_t bEP, uint8_t bEPStatus)
 
     //we read the packet received and put it on the circular buffer
     readEP(c, &size);
-    iprintf("Read %ld bytes:\n\t", size);
+    char d[2];
     for (uint8_t i = 0; i < size; i++) {
 
-        // handle backspace and delete by deleting the last character in the buffer if there is one
-        if(c[i] == 0x08 || c[i] == 0x7F) {
-            if(!rxbuf.isEmpty()) rxbuf.pop();
-            continue;
-        }
-
-        if(c[i] == 'X' - 'A' + 1) { // ^X
-            //THEKERNEL->set_feed_hold(false); // required to free stuff up
-            halt_flag = true;
-            continue;
-        }
-
-        if(c[i] == '?') { // ?
-            query_flag = true;
+        if(binary_mode) {
+            rxbuf.queue(c[i]);
             continue;
         }
 
-        if(THEKERNEL->is_grbl_mode()) {
-            if(c[i] == '!') { // safe pause
-                //THEKERNEL->set_feed_hold(true);
-                continue;
-            }
-
-            if(c[i] == '~') { // safe resume
-                //THEKERNEL->set_feed_hold(false);
-                continue;
-            }
-            // if(last_char_was_dollar && (c[i] == 'X' || c[i] == 'H')) {
-            //     // we need to do this otherwise $X/$H won't work if there was a feed hold like when stop is clicked in bCNC
-            //     THEKERNEL->set_feed_hold(false);
-            // }
-        }
-
-        last_char_was_dollar = (c[i] == '$');
-
-        if (flush_to_nl == false)
-            rxbuf.queue(c[i]);
-
-        // if (c[i] >= 32 && c[i] < 128)
-        // {
-        //     iprintf("%c", c[i]);
-        // }
-        // else
-        // {
-        //     iprintf("\\x%02X", c[i]);
-        // }
-
-        if (c[i] == '\n' || c[i] == '\r') {
-            if (flush_to_nl)
-                flush_to_nl = false;
-            else
-                nl_in_rx++;
-        } else if (rxbuf.isFull() && (nl_in_rx == 0)) {
-            // to avoid a deadlock with very long lines, we must dump the buffer
-            // and continue flushing to the next newline
-            rxbuf.flush();
-            flush_to_nl = true;
+        // a packed stream gives upto two characters per byte
+        int n = meatpack.decode(c[i], d);
+        for (int j = 0; j < n; j++) {
+            receive_char(d[j]);
         }
     }
-    iprintf("\nQueued, %d empty\n", rxbuf.free());
 
-    if (rxbuf.free() < MAX_PACKET_SIZE_EPBULK) {
+    if (rxbuf.free() < rx_space()) {
         // if buffer is full, stall endpoint, do not accept more data
         r = false;
 
-        if (nl_in_rx == 0) {
+        if (nl_in_rx == 0 && !binary_mode) {
             // we have to check for long line deadlock here too
             flush_to_nl = true;
             rxbuf.flush();
@@ -257,11 +318,10 @@ bool USBSerial::USBEvent_EPOut(uint8_t bEP, uint8_t bEPStatus)
     }
 
     usb->readStart(CDC_BulkOut.bEndpointAddress, MAX_PACKET_SIZE_EPBULK);
-    iprintf("USBSerial:EpOut Complete\n");
     return r;
 }
 
-uint8_t USBSerial::available()
+uint16_t USBSerial::available()
 {
     return rxbuf.available();
 }
@@ -271,6 +331,36 @@ bool USBSerial::ready()
     return rxbuf.available();
 }
 
+bool USBSerial::set_packing(uint8_t mode)
+{
+    // the host waits for the ok before sending in the new mode so nothing is in flight
+    __disable_irq();
+    meatpack.set_mode(mode);
+    __enable_irq();
+    return true;
+}
+
+int USBSerial::set_char_counting(bool on)
+{
+    char_counting = on;
+    counting.reset();
+    // rxbuf holds a little more so a whole USB packet always fits
+    return 256;
+}
+
+bool USBSerial::set_binary_mode(bool on)
+{
+    // whatever was received in the other mode is not wanted
+    __disable_irq();
+    binary_mode = on;
+    rxbuf.flush();
+    nl_in_rx = 0;
+    flush_to_nl = false;
+    __enable_irq();
+    usb->endpointSetInterrupt(CDC_BulkOut.bEndpointAddress, true);
+    return true;
+}
+
 void USBSerial::on_module_loaded()
 {
     this->register_for_event(ON_MAIN_LOOP);
@@ -287,8 +377,10 @@ void USBSerial::on_idle(void *argument)
         } else {
             puts("HALTED, M999 or $X to exit HALT state\r\n");
         }
+        __disable_irq();
         rxbuf.flush(); // flush the recieve buffer, hopefully upstream has stopped sending
         nl_in_rx = 0;
+        __enable_irq();
     }
 
     if(query_flag) {
@@ -313,29 +405,35 @@ void USBSerial::on_main_loop(void *argument)
             attached = false;
             THEKERNEL->streams->remove_stream(this);
             txbuf.flush();
+            __disable_irq();
             rxbuf.flush();
             nl_in_rx = 0;
+            __enable_irq();
+            // the next host starts with plain text and oks
+            meatpack.set_mode(MeatPack::OFF);
+            char_counting = false;
         }
     }
 
     // if we are in feed hold we do not process anything
     //if(THEKERNEL->get_feed_hold()) return;
 
-    if (nl_in_rx) {
-        string received;
-        while (available()) {
-            char c = _getc();
-            if( c == '\n' || c == '\r') {
-                struct SerialMessage message;
-                message.message = received;
-                message.stream = this;
-                iprintf("USBSerial Received: %s\n", message.message.c_str());
-                THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
-                return;
-            } else {
-                received += c;
-            }
+    // a line being dispatched may read from us too (uploads) so nl_in_rx is checked again for every line
+    for (int n = 0; n < LINES_PER_LOOP && nl_in_rx > 0; n++) {
+        int len = read_line();
+        if (len < 0)
+            break;
+
+        struct SerialMessage message;
+        message.message.assign(line_buf, len);
+        message.stream = this;
+        if(char_counting && len > 0) {
+            // the line has left rxbuf so the host can send that many more characters
+            puts("ok\r\n");
+            counting.next_line();
+            message.stream = &counting;
         }
+        THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
     }
 }
 
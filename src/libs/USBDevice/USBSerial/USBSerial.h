@@ -25,6 +25,8 @@
 
 #include "Module.h"
 #include "StreamOutput.h"
+#include "MeatPack.h"
+#include "CountingStream.h"
 
 class USBSerial_Receiver {
 protected:
@@ -39,8 +41,11 @@ public:
     int _getc();
     int puts(const char *);
 
-    uint8_t available();
+    uint16_t available();
     bool ready();
+    bool set_binary_mode(bool on);
+    bool set_packing(uint8_t mode);
+    int set_char_counting(bool on);
 
     uint16_t writeBlock(const uint8_t * buf, uint16_t size);
 
@@ -62,6 +67,16 @@ protected:
     virtual void on_detach(void);
 
     void ensure_tx_space(int);
+    void receive_char(uint8_t c);
+    void check_rx_deadlock();
+    int read_line();
+    // room needed in rxbuf for a packet, packed bytes can give two characters each
+    int rx_space() const { return meatpack.get_mode() == MeatPack::OFF ? MAX_PACKET_SIZE_EPBULK : MAX_PACKET_SIZE_EPBULK * 2; }
+
+    MeatPack meatpack;
+    CountingStream counting;
+    // the line being dispatched, filled straight from rxbuf
+    char *line_buf;
 
     // keep track of number of newlines in the buffer
     // this makes it trivial to detect if there's a new line available
@@ -80,6 +95,10 @@ protected:
         // flushing until we find a newline.
         // this flag asserts when we are doing this
         bool flush_to_nl:1;
+        // everything received is queued as is, used for binary uploads
+        bool binary_mode:1;
+        // oks are sent as lines are taken from rxbuf, replies then go through counting
+        bool char_counting:1;
     };
 
 private:
@@ -15,6 +15,7 @@
 #include <cstring>
 #include <stdio.h>
 #include <cstdlib>
+#include <cmath>
 
 #include "mbed.h"
 
@@ -39,6 +40,19 @@ uint16_t get_checksum(const char *to_check)
     return (sum2 << 8) | sum1;
 }
 
+// the CRC-32 used by zlib, pass the previous result to continue it over more data
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    crc = ~crc;
+    while(len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
 void get_checksums(uint16_t check_sums[], const string &key)
 {
     check_sums[0] = 0x0000;
@@ -249,8 +263,86 @@ int append_parameters(char *buf, std::vector<std::pair<char,float>> params, size
     for(auto &i : params) {
         if(n >= bufsize) break;
         buf[n++]= i.first;
-        n += snprintf(&buf[n], bufsize-n, "%1.4f ", i.second);
+        n += format_float(&buf[n], bufsize-n, i.second);
+        if(n < bufsize-1) buf[n++]= ' ';
+    }
+    if(n < bufsize) buf[n]= '\0';
+    return n;
+}
+
+// same as snprintf(buf, bufsize, "%1.<decimals>f", value) for decimals 0 to 6 but much faster as it avoids the soft float printf
+// falls back to snprintf for values that do not fit in 32 bits and nan/inf
+int format_float(char *buf, size_t bufsize, float value, int decimals)
+{
+    static const uint32_t scales[]= {1, 10, 100, 1000, 10000, 100000, 1000000};
+    if(decimals < 0) decimals= 0;
+    if(decimals > 6) decimals= 6;
+
+    float a= value < 0 ? -value : value;
+    if(!(a < 4294967040.0F) || bufsize < 24) { // also catches nan
+        return snprintf(buf, bufsize, "%1.*f", decimals, value);
+    }
+
+    // the integer and fractional parts of a float are exact, the fraction is mantissa * 2^-shift so it can be scaled exactly in 64 bits
+    uint32_t ip= a;
+    int e;
+    uint64_t mantissa= frexpf(a - ip, &e) * 16777216.0F;
+    int shift= 24 - e;
+    uint32_t fp= 0;
+    if(shift < 64) {
+        uint64_t f= mantissa * scales[decimals];
+        uint64_t half= 1ULL << (shift - 1);
+        uint64_t rem= f & ((half << 1) - 1);
+        fp= f >> shift;
+        // round half to even like printf
+        if(rem > half || (rem == half && (((decimals > 0 ? fp : ip) & 1) != 0))) {
+            if(++fp == scales[decimals]) {
+                fp= 0;
+                ++ip;
+            }
+        }
+    }
+
+    char *p= buf;
+    if(std::signbit(value)) *p++= '-';
+
+    // integer part, digits come out backwards
+    char tmp[10];
+    int n= 0;
+    do {
+        tmp[n++]= '0' + (ip % 10);
+        ip /= 10;
+    } while(ip > 0);
+    while(n > 0) *p++= tmp[--n];
+
+    if(decimals > 0) {
+        *p++= '.';
+        for (int i = decimals - 1; i >= 0; --i) {
+            p[i]= '0' + (fp % 10);
+            fp /= 10;
+        }
+        p += decimals;
+    }
+    *p= '\0';
+    return p - buf;
+}
+
+// formats count values separated by commas, or if labels is given each value is preceded by a space (except the first) and its label and a colon eg X:1.0000 Y:2.0000
+int format_floats(char *buf, size_t bufsize, const float *values, int count, const char *labels, int decimals)
+{
+    size_t n= 0;
+    for (int i = 0; i < count && n + 4 < bufsize; ++i) {
+        if(labels != nullptr) {
+            if(i > 0) buf[n++]= ' ';
+            buf[n++]= labels[i];
+            buf[n++]= ':';
+
+        }else if(i > 0) {
+            buf[n++]= ',';
+        }
+        n += format_float(&buf[n], bufsize - n, values[i], decimals);
     }
+    if(n < bufsize) buf[n]= '\0';
     return n;
 }
 
@@ -21,6 +21,8 @@ std::string remove_non_number( std::string str );
 uint16_t get_checksum(const std::string& to_check);
 uint16_t get_checksum(const char* to_check);
 
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc= 0);
+
 void get_checksums(uint16_t check_sums[], const std::string& key);
 
 std::string shift_parameter( std::string &parameters );
@@ -34,6 +36,8 @@ void system_reset( bool dfu= false );
 std::string absolute_from_relative( std::string path );
 
 int append_parameters(char *buf, std::vector<std::pair<char,float>> params, size_t bufsize);
+int format_float(char *buf, size_t bufsize, float value, int decimals= 4);
+int format_floats(char *buf, size_t bufsize, const float *values, int count, const char *labels= nullptr, int decimals= 4);
 std::string wcs2gcode(int wcs);
 void safe_delay_us(uint32_t delay);
 void safe_delay_ms(uint32_t delay);
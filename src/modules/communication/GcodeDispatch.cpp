@@ -10,6 +10,7 @@
 #include "libs/Kernel.h"
 #include "Robot.h"
 #include "utils/Gcode.h"
+#include "utils/ResendWindow.h"
 #include "libs/nuts_bolts.h"
 #include "modules/robot/Conveyor.h"
 #include "libs/SerialMessage.h"
@@ -25,6 +26,13 @@
 #include "SimpleShell.h"
 #include "utils.h"
 #include "LPC17xx.h"
+#include "platform_memory.h"
+#include "MeatPack.h"
+#include "us_ticker_api.h"
+
+#include <new>
+#include <string.h>
+#include <algorithm>
 
 #define panel_display_message_checksum CHECKSUM("display_message")
 #define panel_checksum             CHECKSUM("panel")
@@ -41,8 +49,10 @@ static bool is_allowed_mcode(int m) {
 GcodeDispatch::GcodeDispatch()
 {
     uploading = false;
-    currentline = -1;
     modal_group_1= 0;
+    gcode_pool= nullptr;
+    gcode_pool_used= 0;
+    gcode_pool_tried= false;
 }
 
 // Called when the module has just been loaded
@@ -51,25 +61,148 @@ void GcodeDispatch::on_module_loaded()
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
 }
 
+// get a Gcode from the pool, if they are all in use (nested dispatch) then use the heap
+Gcode *GcodeDispatch::new_gcode(const char *line, size_t len, StreamOutput *stream)
+{
+    if(!gcode_pool_tried) {
+        // fixed pool of Gcode objects in AHB0 so dispatching a line does not touch the heap, falls back to the heap if we ran out of AHB0
+        // allocated on first use so the planner queue, which is allocated after config, has first call on AHB0
+        gcode_pool_tried= true;
+        gcode_pool= AHB0.alloc(sizeof(Gcode) * GCODE_POOL_SIZE);
+    }
+
+    if(gcode_pool != nullptr) {
+        for (int i = 0; i < GCODE_POOL_SIZE; ++i) {
+            if((gcode_pool_used & (1 << i)) == 0) {
+                gcode_pool_used |= (1 << i);
+                return new(static_cast<Gcode *>(gcode_pool) + i) Gcode(line, len, stream);
+            }
+        }
+    }
+    return new Gcode(line, len, stream);
+}
+
+void GcodeDispatch::release_gcode(Gcode *gcode)
+{
+    Gcode *pool= static_cast<Gcode *>(gcode_pool);
+    if(pool != nullptr && gcode >= pool && gcode < pool + GCODE_POOL_SIZE) {
+        gcode->~Gcode();
+        gcode_pool_used &= ~(1 << (gcode - pool));
+
+    }else{
+        delete gcode;
+    }
+}
+
+// dispatch a command that was tokenized offline (eg a binary job played by Player), the tokenizer only
+// produces plain G and M codes that need none of the special handling in on_console_line_received()
+void GcodeDispatch::dispatch_tokenized(Gcode *gcode)
+{
+    if(reject_when_halted(gcode)) return;
+
+    // remember last modal group 1 code
+    if(gcode->has_g && gcode->g < 4) {
+        modal_group_1= gcode->g;
+    }
+
+    dispatch_gcode(gcode, true);
+}
+
+// while halted everything but M999 and a few M codes is ignored, returns true if the gcode was and the host has been told
+bool GcodeDispatch::reject_when_halted(Gcode *gcode)
+{
+    if(!THEKERNEL->is_halted() || (gcode->has_m && is_allowed_mcode(gcode->m))) return false;
+
+    // ignore everything, return error string to host
+    if(THEKERNEL->is_grbl_mode()) {
+        gcode->stream->printf("error:Alarm lock\n");
+
+    }else{
+        gcode->stream->printf("!!\r\n");
+    }
+    return true;
+}
+
+// pass the gcode to the modules and reply to the host, last is false for all but the last command of a line with several
+void GcodeDispatch::dispatch_gcode(Gcode *gcode, bool last)
+{
+    StreamOutput *stream= gcode->stream;
+
+    //printf("dispatch %p: '%s' G%d M%d...", gcode, gcode->get_command(), gcode->g, gcode->m);
+    //Dispatch message! unless it could not be parsed in full
+    if(!gcode->is_error) THEKERNEL->call_event(ON_GCODE_RECEIVED, gcode );
+
+    if (gcode->is_error) {
+        // report error
+        if(THEKERNEL->is_grbl_mode()) {
+            stream->printf("error: ");
+        }else{
+            stream->printf("Error: ");
+        }
+
+        if(!gcode->txt_after_ok.empty()) {
+            stream->printf("%s\r\n", gcode->txt_after_ok.c_str());
+            gcode->txt_after_ok.clear();
+
+        }else{
+            stream->printf("unknown\r\n");
+        }
+
+        // we cannot continue safely after an error so we enter HALT state
+        stream->printf("Entering Alarm/Halt state\n");
+        THEKERNEL->call_event(ON_HALT, nullptr);
+
+    }else{
+
+        if(gcode->add_nl)
+            stream->printf("\r\n");
+
+        if(!gcode->txt_after_ok.empty()) {
+            stream->printf("ok %s\r\n", gcode->txt_after_ok.c_str());
+            gcode->txt_after_ok.clear();
+
+        } else {
+            if(THEKERNEL->is_ok_per_line() || THEKERNEL->is_grbl_mode()) {
+                // only send ok once per line if this is a multi g code line send ok on the last one
+                if(last)
+                    stream->printf("ok\r\n");
+            } else {
+                // maybe should do the above for all hosts?
+                stream->printf("ok\r\n");
+            }
+        }
+    }
+}
+
+// first char in [p, end) that is in chars, end if none
+static const char *find_first_of(const char *p, const char *end, const char *chars)
+{
+    for (; p < end; ++p) {
+        if(strchr(chars, *p) != nullptr) return p;
+    }
+    return end;
+}
+
 // When a command is received, if it is a Gcode, dispatch it as an object via an event
+// The line is processed in place, begin and end delimit the part of it that is still to be processed
 void GcodeDispatch::on_console_line_received(void *line)
 {
-    SerialMessage new_message = *static_cast<SerialMessage *>(line);
-    string possible_command = new_message.message;
+    SerialMessage& new_message = *static_cast<SerialMessage *>(line);
+    const char *begin= new_message.message.c_str();
+    const char *end= begin + new_message.message.size();
 
     int ln = 0;
     int cs = 0;
+    int chksum = -1;
 
     // just reply ok to empty lines
-    if(possible_command.empty()) {
+    if(begin == end) {
         new_message.stream->printf("ok\r\n");
         return;
     }
 
-try_again:
-
-    char first_char = possible_command[0];
-    unsigned int n;
+    char first_char = *begin;
+    bool implied_g= false;
 
     if(first_char == '$') {
         // ignore as simpleshell will handle it
@@ -80,72 +213,72 @@ try_again:
         return;
     }
 
-    if ( first_char == 'G' || first_char == 'M' || first_char == 'T' || first_char == 'S' || first_char == 'N' ) {
+    if ( first_char != 'G' && first_char != 'M' && first_char != 'T' && first_char != 'S' && first_char != 'N' ) {
+        const char *n= find_first_of(begin, end, "XYZF");
+        if( n == begin || (first_char == ' ' && n != end) ) {
+            // handle pycam syntax, use last modal group 1 command if an X Y Z or F is found on its own line
+            implied_g= true;
+        }
+    }
+
+    if ( first_char == 'G' || first_char == 'M' || first_char == 'T' || first_char == 'S' || first_char == 'N' || implied_g ) {
 
         //Get linenumber
         if ( first_char == 'N' ) {
-            Gcode full_line = Gcode(possible_command, new_message.stream, false);
+            Gcode full_line(begin, end - begin, new_message.stream, false);
             ln = (int) full_line.get_value('N');
-            int chksum = (int) full_line.get_value('*');
+            chksum = full_line.has_letter('*') ? (int) full_line.get_value('*') : -1;
 
             //Catch message if it is M110: Set Current Line Number
             if ( full_line.has_m ) {
                 if ( full_line.m == 110 ) {
-                    currentline = ln;
+                    resend_window.set_line(ln);
                     new_message.stream->printf("ok\r\n");
                     return;
                 }
             }
 
-            //Strip checksum value from possible_command
-            size_t chkpos = possible_command.find_first_of("*");
-            possible_command = possible_command.substr(0, chkpos);
-            //Calculate checksum
-            if ( chkpos != string::npos ) {
-                for (auto c = possible_command.cbegin(); *c != '*' && c != possible_command.cend(); c++)
+            //Strip checksum value from the line and calculate checksum
+            const char *chkpos = find_first_of(begin, end, "*");
+            if ( chkpos != end ) {
+                for (const char *c = begin; c != chkpos; c++)
                     cs = cs ^ *c;
                 cs &= 0xff;  // Defensive programming...
                 cs -= chksum;
+                end = chkpos;
             }
-            //Strip line number value from possible_command
-            size_t lnsize = possible_command.find_first_not_of("N0123456789.,- ");
-            possible_command = possible_command.substr(lnsize);
+            //Strip line number value from the line
+            while(begin < end && strchr("N0123456789.,- ", *begin) != nullptr) ++begin;
 
         } else {
             //Assume checks succeeded
             cs = 0x00;
-            ln = currentline + 1;
+            ln = resend_window.next_line();
         }
 
         //Remove comments
-        size_t comment = possible_command.find_first_of(";(");
-        if( comment != string::npos ) {
-            possible_command = possible_command.substr(0, comment);
-        }
+        end = find_first_of(begin, end, ";(");
 
         //If checksum passes then process message, else request resend
-        int nextline = currentline + 1;
-        if( cs == 0x00 && ln == nextline ) {
-            if( first_char == 'N' ) {
-                currentline = nextline;
-            }
+        ResendWindow::ACTION action = ResendWindow::RUN;
+        if( first_char == 'N' ) action = resend_window.check(ln, chksum, cs == 0x00, us_ticker_read());
 
-            while(possible_command.size() > 0) {
+        if( action == ResendWindow::RUN ) {
+            while(begin < end) {
                 // assumes G or M are always the first on the line
-                size_t nextcmd = possible_command.find_first_of("GM", 2);
-                string single_command;
-                if(nextcmd == string::npos) {
-                    single_command = possible_command;
-                    possible_command = "";
-                } else {
-                    single_command = possible_command.substr(0, nextcmd);
-                    possible_command = possible_command.substr(nextcmd);
-                }
-
+                const char *single_command= begin;
+                begin = (end - begin > 2) ? find_first_of(begin + 2, end, "GM") : end;
+                size_t single_len= begin - single_command;
 
                 if(!uploading || upload_stream != new_message.stream) {
                     // Prepare gcode for dispatch
-                    Gcode *gcode = new Gcode(single_command, new_message.stream);
+                    Gcode *gcode = new_gcode(single_command, single_len, new_message.stream);
+                    if(implied_g) {
+                        // pycam syntax, pass through as if it was the last G0 thru G3
+                        gcode->has_g= true;
+                        gcode->g= modal_group_1;
+                        implied_g= false;
+                    }
 
                     if(THEKERNEL->is_halted()) {
                         // we ignore all commands until M999, unless it is in the exceptions list (like M105 get temp)
@@ -155,18 +288,11 @@ try_again:
                                 new_message.stream->printf("WARNING: After HALT you should HOME as position is currently unknown\n");
                             }
                             new_message.stream->printf("ok\n");
-                            delete gcode;
+                            release_gcode(gcode);
                             continue;
 
-                        }else if(!is_allowed_mcode(gcode->m)) {
-                            // ignore everything, return error string to host
-                            if(THEKERNEL->is_grbl_mode()) {
-                                new_message.stream->printf("error:Alarm lock\n");
-
-                            }else{
-                                new_message.stream->printf("!!\r\n");
-                            }
-                            delete gcode;
+                        }else if(reject_when_halted(gcode)) {
+                            release_gcode(gcode);
                             continue;
                         }
                     }
@@ -175,11 +301,11 @@ try_again:
                         if(gcode->g == 53) { // G53 makes next movement command use machine coordinates
                             // this is ugly to implement as there may or may not be a G0/G1 on the same line
                             // valid version seem to include G53 G0 X1 Y2 Z3 G53 X1 Y2
-                            if(possible_command.empty()) {
+                            if(begin == end) {
                                 // use last gcode G1 or G0 if none on the line, and pass through as if it was a G0/G1
                                 // TODO it is really an error if the last is not G0 thru G3
                                 if(modal_group_1 > 3) {
-                                    delete gcode;
+                                    release_gcode(gcode);
                                     new_message.stream->printf("ok - Invalid G53\r\n");
                                     return;
                                 }
@@ -187,13 +313,13 @@ try_again:
                                 gcode->g= modal_group_1;
 
                             }else{
-                                delete gcode;
+                                release_gcode(gcode);
                                 // extract next G0/G1 from the rest of the line, ignore if it is not one of these
-                                gcode = new Gcode(possible_command, new_message.stream);
-                                possible_command= "";
+                                gcode = new_gcode(begin, end - begin, new_message.stream);
+                                begin= end;
                                 if(!gcode->has_g || gcode->g > 1) {
                                     // not G0 or G1 so ignore it as it is invalid
-                                    delete gcode;
+                                    release_gcode(gcode);
                                     new_message.stream->printf("ok - Invalid G53\r\n");
                                     return;
                                 }
@@ -212,9 +338,9 @@ try_again:
                     if(gcode->has_m) {
                         switch (gcode->m) {
                             case 28: // start upload command
-                                delete gcode;
+                                release_gcode(gcode);
 
-                                this->upload_filename = "/sd/" + single_command.substr(4); // rest of line is filename
+                                this->upload_filename = "/sd/" + string(single_command + std::min(single_len, (size_t)4), begin); // rest of line is filename
                                 // open file
                                 upload_fd = fopen(this->upload_filename.c_str(), "w");
                                 if(upload_fd != NULL) {
@@ -249,25 +375,47 @@ try_again:
                                 // disables heaters and motors, ignores further incoming Gcode and clears block queue
                                 THEKERNEL->call_event(ON_HALT, nullptr);
                                 THEKERNEL->streams->printf("ok Emergency Stop Requested - reset or M999 required to exit HALT state\r\n");
-                                delete gcode;
+                                release_gcode(gcode);
                                 return;
 
                             case 117: // M117 is a special non compliant Gcode as it allows arbitrary text on the line following the command
-                            {    // concatenate the command again and send to panel if enabled
-                                string str= single_command.substr(4) + possible_command;
+                            {    // the rest of the line is sent to panel if enabled
+                                string str(single_command + std::min(single_len, (size_t)4), end);
                                 PublicData::set_value( panel_checksum, panel_display_message_checksum, &str );
-                                delete gcode;
+                                release_gcode(gcode);
+                                new_message.stream->printf("ok\r\n");
+                                return;
+                            }
+
+                            case 860: // M860 S1 packs the stream from this host with MeatPack, S2 also leaves out spaces, S0 is plain text
+                            {   // the host must wait for the ok before sending in the new mode
+                                int mode= gcode->has_letter('S') ? gcode->get_int('S') : 0;
+                                release_gcode(gcode);
+                                if(mode < 0 || mode > MeatPack::PACKED_NO_SPACES || !new_message.stream->set_packing(mode)) {
+                                    new_message.stream->printf("error:packing not supported\r\n");
+                                }
+                                new_message.stream->printf("ok\r\n");
+                                return;
+                            }
+
+                            case 861: // M861 S1 sends the ok for each line from this host as soon as it is received so it can count characters to keep the receive buffer full
+                            {
+                                int size= new_message.stream->set_char_counting(gcode->has_letter('S') && gcode->get_int('S') == 1);
+                                release_gcode(gcode);
+                                if(size > 0) new_message.stream->printf("rx_buffer:%d\r\n", size);
+                                else new_message.stream->printf("error:character counting not supported\r\n");
                                 new_message.stream->printf("ok\r\n");
                                 return;
                             }
 
                             case 1000: // M1000 is a special command that will pass thru the raw lowercased command to the simpleshell (for hosts that do not allow such things)
                             {
-                                // reconstruct entire command line again
-                                string str= single_command.substr(5) + possible_command;
-                                while(is_whitespace(str.front())){ str= str.substr(1); } // strip leading whitespace
+                                // the rest of the line is the command
+                                const char *p= single_command + std::min(single_len, (size_t)5);
+                                while(p < end && is_whitespace(*p)){ ++p; } // strip leading whitespace
+                                string str(p, end);
 
-                                delete gcode;
+                                release_gcode(gcode);
 
                                 if(str.empty()) {
                                     SimpleShell::parse_command("help", "", new_message.stream);
@@ -299,7 +447,7 @@ try_again:
                                 // dispatch the M500 here so we can free up the stream when done
                                 THEKERNEL->call_event(ON_GCODE_RECEIVED, gcode );
                                 delete gcode->stream;
-                                delete gcode;
+                                release_gcode(gcode);
                                 __enable_irq();
                                 new_message.stream->printf("Settings Stored to %s\r\nok\r\n", THEKERNEL->config_override_filename());
                                 continue;
@@ -307,19 +455,19 @@ try_again:
                             case 501: // load config override
                             case 504: // save to specific config override file
                                 {
-                                    string arg= get_arguments(single_command + possible_command); // rest of line is filename
+                                    string arg= get_arguments(string(single_command, end)); // rest of line is filename
                                     if(arg.empty()) arg= "/sd/config-override";
                                     else arg= "/sd/config-override." + arg;
                                     //new_message.stream->printf("args: <%s>\n", arg.c_str());
                                     SimpleShell::parse_command((gcode->m == 501) ? "load_command" : "save_command", arg, new_message.stream);
                                 }
-                                delete gcode;
+                                release_gcode(gcode);
                                 new_message.stream->printf("ok\r\n");
                                 return;
 
                             case 502: // M502 deletes config-override so everything defaults to what is in config
                                 remove(THEKERNEL->config_override_filename());
-                                delete gcode;
+                                release_gcode(gcode);
                                 new_message.stream->printf("config override file deleted %s, reboot needed\r\nok\r\n", THEKERNEL->config_override_filename());
                                 continue;
 
@@ -339,56 +487,12 @@ try_again:
                         }
                     }
 
-                    //printf("dispatch %p: '%s' G%d M%d...", gcode, gcode->command.c_str(), gcode->g, gcode->m);
-                    //Dispatch message!
-                    THEKERNEL->call_event(ON_GCODE_RECEIVED, gcode );
-
-                    if (gcode->is_error) {
-                        // report error
-                        if(THEKERNEL->is_grbl_mode()) {
-                            new_message.stream->printf("error: ");
-                        }else{
-                            new_message.stream->printf("Error: ");
-                        }
-
-                        if(!gcode->txt_after_ok.empty()) {
-                            new_message.stream->printf("%s\r\n", gcode->txt_after_ok.c_str());
-                            gcode->txt_after_ok.clear();
-
-                        }else{
-                            new_message.stream->printf("unknown\r\n");
-                        }
-
-                        // we cannot continue safely after an error so we enter HALT state
-                        new_message.stream->printf("Entering Alarm/Halt state\n");
-                        THEKERNEL->call_event(ON_HALT, nullptr);
-
-                    }else{
-
-                        if(gcode->add_nl)
-                            new_message.stream->printf("\r\n");
-
-                        if(!gcode->txt_after_ok.empty()) {
-                            new_message.stream->printf("ok %s\r\n", gcode->txt_after_ok.c_str());
-                            gcode->txt_after_ok.clear();
-
-                        } else {
-                            if(THEKERNEL->is_ok_per_line() || THEKERNEL->is_grbl_mode()) {
-                                // only send ok once per line if this is a multi g code line send ok on the last one
-                                if(possible_command.empty())
-                                    new_message.stream->printf("ok\r\n");
-                            } else {
-                                // maybe should do the above for all hosts?
-                                new_message.stream->printf("ok\r\n");
-                            }
-                        }
-                    }
-
-                    delete gcode;
+                    dispatch_gcode(gcode, begin == end);
+                    release_gcode(gcode);
 
                 } else {
                     // we are uploading and it is the upload stream so so save it
-                    if(single_command.substr(0, 3) == "M29") {
+                    if(single_len >= 3 && strncmp(single_command, "M29", 3) == 0) {
                         // done uploading, close file
                         fclose(upload_fd);
                         upload_fd = NULL;
@@ -405,9 +509,8 @@ try_again:
                         continue;
                     }
 
-                    single_command.append("\n");
                     static int cnt = 0;
-                    if(fwrite(single_command.c_str(), 1, single_command.size(), upload_fd) != single_command.size()) {
+                    if(fwrite(single_command, 1, single_len, upload_fd) != single_len || fputc('\n', upload_fd) == EOF) {
                         // error writing to file
                         new_message.stream->printf("Error:error writing to file.\r\n");
                         fclose(upload_fd);
@@ -415,7 +518,7 @@ try_again:
                         continue;
 
                     } else {
-                        cnt += single_command.size();
+                        cnt += single_len + 1;
                         if (cnt > 400) {
                             // HACK ALERT to get around fwrite corruption close and re open for append
                             fclose(upload_fd);
@@ -428,21 +531,19 @@ try_again:
                 }
             }
 
-        } else {
-            //Request resend
-            new_message.stream->printf("rs N%d\r\n", nextline);
-        }
+        } else if( action == ResendWindow::DUPLICATE ) {
+            // a line that was already done, sent again by a host that went back further than the line asked for
+            new_message.stream->printf("ok\r\n");
 
-    } else if( (n=possible_command.find_first_of("XYZF")) == 0 || (first_char == ' ' && n != string::npos) ) {
-        // handle pycam syntax, use last modal group 1 command and resubmit if an X Y Z or F is found on its own line
-        char buf[6];
-        snprintf(buf, sizeof(buf), "G%d ", modal_group_1);
-        possible_command.insert(0, buf);
-        goto try_again;
+        } else if( action == ResendWindow::MISMATCH ) {
+            new_message.stream->printf("error:N%d was already received and is not the same line, expected N%d\r\n", ln, resend_window.next_line());
+
+        } else if( action == ResendWindow::RESEND ) {
+            new_message.stream->printf("rs N%d\r\n", resend_window.next_line());
+        }
 
         // Ignore comments and blank lines
     } else if ( first_char == ';' || first_char == '(' || first_char == ' ' || first_char == '\n' || first_char == '\r' ) {
         new_message.stream->printf("ok\r\n");
     }
 }
-
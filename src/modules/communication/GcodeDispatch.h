@@ -8,11 +8,16 @@
 #pragma once
 
 #include "libs/Module.h"
+#include "utils/ResendWindow.h"
 
 #include <stdio.h>
 #include <string>
 
 class StreamOutput;
+class Gcode;
+
+// number of Gcode objects in the dispatch pool, more than one as dispatching can be nested
+#define GCODE_POOL_SIZE 4
 
 class GcodeDispatch : public Module
 {
@@ -21,15 +26,24 @@ public:
 
     virtual void on_module_loaded();
     virtual void on_console_line_received(void *line);
+    void dispatch_tokenized(Gcode *gcode);
 
     uint8_t get_modal_command() const { return modal_group_1<4 ? modal_group_1 : 0; }
 private:
-    int currentline;
+    Gcode *new_gcode(const char *line, size_t len, StreamOutput *stream);
+    void release_gcode(Gcode *gcode);
+    bool reject_when_halted(Gcode *gcode);
+    void dispatch_gcode(Gcode *gcode, bool last);
+
+    ResendWindow resend_window;
     std::string upload_filename;
     FILE *upload_fd;
     StreamOutput* upload_stream{nullptr};
+    void *gcode_pool;
+    uint8_t gcode_pool_used;
     uint8_t modal_group_1;
     struct {
         bool uploading: 1;
+        bool gcode_pool_tried: 1;
     };
 };
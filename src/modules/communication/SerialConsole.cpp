@@ -20,7 +20,7 @@ using std::string;
 // Serial reading module
 // Treats every received line as a command and passes it ( via event call ) to the command dispatcher.
 // The command dispatcher will then ask other modules if they can do something with it
-SerialConsole::SerialConsole( PinName rx_pin, PinName tx_pin, int baud_rate ){
+SerialConsole::SerialConsole( PinName rx_pin, PinName tx_pin, int baud_rate ) : counting(this) {
     this->serial = new mbed::Serial( rx_pin, tx_pin );
     this->serial->baud(baud_rate);
 }
@@ -31,6 +31,7 @@ void SerialConsole::on_module_loaded() {
     this->serial->attach(this, &SerialConsole::on_serial_char_received, mbed::Serial::RxIrq);
     query_flag= false;
     halt_flag= false;
+    char_counting= false;
 
     // We only call the command dispatcher in the main loop, nowhere else
     this->register_for_event(ON_MAIN_LOOP);
@@ -43,21 +44,41 @@ void SerialConsole::on_module_loaded() {
 // Called on Serial::RxIrq interrupt, meaning we have received a char
 void SerialConsole::on_serial_char_received(){
     while(this->serial->readable()){
-        char received = this->serial->getc();
-        if(received == '?') {
-            query_flag= true;
-            continue;
-        }
-        if(received == 'X'-'A'+1) { // ^X
-            halt_flag= true;
-            continue;
+        // a packed stream gives upto two characters per byte
+        char d[2];
+        int n= this->meatpack.decode(this->serial->getc(), d);
+        for (int i = 0; i < n; ++i) {
+            char received = d[i];
+            if(received == '?') {
+                query_flag= true;
+                continue;
+            }
+            if(received == 'X'-'A'+1) { // ^X
+                halt_flag= true;
+                continue;
+            }
+            // convert CR to NL (for host OSs that don't send NL)
+            if( received == '\r' ){ received = '\n'; }
+            this->buffer.push_back(received);
         }
-        // convert CR to NL (for host OSs that don't send NL)
-        if( received == '\r' ){ received = '\n'; }
-        this->buffer.push_back(received);
     }
 }
 
+int SerialConsole::set_char_counting(bool on)
+{
+    this->char_counting= on;
+    this->counting.reset();
+    return this->buffer.capacity();
+}
+
+bool SerialConsole::set_packing(uint8_t mode)
+{
+    __disable_irq();
+    this->meatpack.set_mode(mode);
+    __enable_irq();
+    return true;
+}
+
 void SerialConsole::on_idle(void * argument)
 {
     if(query_flag) {
@@ -82,6 +103,12 @@ void SerialConsole::on_main_loop(void * argument){
                 struct SerialMessage message;
                 message.message = received;
                 message.stream = this;
+                if(char_counting && !received.empty()) {
+                    // the line has left the buffer so the host can send that many more characters
+                    puts("ok\r\n");
+                    counting.next_line();
+                    message.stream = &counting;
+                }
                 THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
                 return;
             }else{
@@ -16,6 +16,8 @@
 using std::string;
 #include "libs/RingBuffer.h"
 #include "libs/StreamOutput.h"
+#include "libs/MeatPack.h"
+#include "libs/CountingStream.h"
 
 
 #define baud_rate_setting_checksum CHECKSUM("baud_rate")
@@ -33,14 +35,19 @@ class SerialConsole : public Module, public StreamOutput {
         int _putc(int c);
         int _getc(void);
         int puts(const char*);
+        bool set_packing(uint8_t mode);
+        int set_char_counting(bool on);
 
         //string receive_buffer;                 // Received chars are stored here until a newline character is received
         //vector<std::string> received_lines;    // Received lines are stored here until they are requested
         RingBuffer<char,256> buffer;             // Receive buffer
         mbed::Serial* serial;
+        MeatPack meatpack;
+        CountingStream counting;
         struct {
           bool query_flag:1;
           bool halt_flag:1;
+          bool char_counting:1;
         };
 };
 
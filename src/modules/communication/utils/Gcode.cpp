@@ -10,132 +10,230 @@
 #include "libs/StreamOutput.h"
 #include "utils.h"
 #include <stdlib.h>
+#include <string.h>
 #include <algorithm>
 
 // This is a gcode object. It represents a GCode string/command, and caches some important values about that command for the sake of performance.
-// It gets passed around in events, and attached to the queue ( that'll change )
-Gcode::Gcode(const string &command, StreamOutput *stream, bool strip)
+// The line is split into letter/value words once in the constructor, all the accessors are then simple lookups in the word array
+Gcode::Gcode(const char *line, size_t len, StreamOutput *stream, bool strip)
 {
-    this->command= strdup(command.c_str());
     this->m= 0;
     this->g= 0;
     this->subcode= 0;
     this->add_nl= false;
     this->is_error= false;
     this->stream= stream;
-    prepare_cached_values(strip);
+    this->command= short_command;
+    prepare_cached_values(line, len, strip);
     this->stripped= strip;
 }
 
+Gcode::Gcode(const char *line, StreamOutput *stream, bool strip) : Gcode(line, strlen(line), stream, strip)
+{
+}
+
+Gcode::Gcode(const string &line, StreamOutput *stream, bool strip) : Gcode(line.data(), line.size(), stream, strip)
+{
+}
+
+Gcode::Gcode(StreamOutput *stream)
+{
+    this->m= 0;
+    this->g= 0;
+    this->subcode= 0;
+    this->add_nl= false;
+    this->is_error= false;
+    this->has_m= false;
+    this->has_g= false;
+    this->stripped= true;
+    this->stream= stream;
+    this->num_words= 0;
+    this->command= short_command;
+    this->command[0]= '\0';
+}
+
 Gcode::~Gcode()
 {
-    if(command != nullptr) {
-        // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
-        free(command);
-    }
+    if(command != short_command) delete[] command;
 }
 
 Gcode::Gcode(const Gcode &to_copy)
 {
-    this->command               = strdup(to_copy.command); // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
-    this->has_m                 = to_copy.has_m;
-    this->has_g                 = to_copy.has_g;
-    this->m                     = to_copy.m;
-    this->g                     = to_copy.g;
-    this->subcode               = to_copy.subcode;
-    this->add_nl                = to_copy.add_nl;
-    this->is_error              = to_copy.is_error;
-    this->stream                = to_copy.stream;
-    this->txt_after_ok.assign( to_copy.txt_after_ok );
+    this->command= short_command;
+    *this= to_copy;
 }
 
 Gcode &Gcode::operator= (const Gcode &to_copy)
 {
     if( this != &to_copy ) {
-        this->command               = strdup(to_copy.command); // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
         this->has_m                 = to_copy.has_m;
         this->has_g                 = to_copy.has_g;
         this->m                     = to_copy.m;
         this->g                     = to_copy.g;
         this->subcode               = to_copy.subcode;
         this->add_nl                = to_copy.add_nl;
+        this->stripped              = to_copy.stripped;
         this->is_error              = to_copy.is_error;
         this->stream                = to_copy.stream;
         this->txt_after_ok.assign( to_copy.txt_after_ok );
+        this->num_words             = to_copy.num_words;
+        memcpy(this->words, to_copy.words, sizeof(words[0]) * num_words);
+        if(!set_command(to_copy.command, strlen(to_copy.command))) {
+            // the values are still there but not the text they came from
+            for (int i = 0; i < num_words; ++i) words[i].pos= NO_POS;
+            this->is_error= true;
+            this->txt_after_ok= "command too long";
+        }
     }
     return *this;
 }
 
-
-// Whether or not a Gcode has a letter
-bool Gcode::has_letter( char letter ) const
+// copy the command text, into short_command if it fits else onto the heap, returns false if it had to be truncated
+bool Gcode::set_command(const char *text, size_t len)
 {
-    for (size_t i = 0; i < strlen(this->command); ++i) {
-        if( command[i] == letter ) {
-            return true;
+    if(command != short_command) delete[] command;
+    command= short_command;
+
+    bool ok= true;
+    if(len >= GCODE_MAX_LENGTH) {
+        char *buf= len < NO_POS ? new char[len + 1] : nullptr;
+        if(buf != nullptr) {
+            command= buf;
+        } else {
+            len= GCODE_MAX_LENGTH - 1;
+            ok= false;
         }
     }
-    return false;
+    memcpy(command, text, len);
+    command[len]= '\0';
+    return ok;
 }
 
-// Retrieve the value for a given letter
-float Gcode::get_value( char letter, char **ptr ) const
-{
-    const char *cs = command;
-    char *cn = NULL;
-    for (; *cs; cs++) {
-        if( letter == *cs ) {
-            cs++;
-            float r = strtof(cs, &cn);
-            if(ptr != nullptr) *ptr= cn;
-            if (cn > cs)
-                return r;
+// add a word to a tokenized command, returns false if there are already too many
+bool Gcode::add_word(char letter, bool has_value, float value)
+{
+    if(num_words >= GCODE_MAX_WORDS) return false;
+    word_t &w= words[num_words++];
+    w.letter= letter;
+    w.pos= NO_POS;
+    w.has_value= has_value;
+    w.value= has_value ? value : 0;
+    return true;
+}
+
+static const float powers_of_ten[]= {1E0F, 1E1F, 1E2F, 1E3F, 1E4F, 1E5F, 1E6F, 1E7F, 1E8F, 1E9F, 1E10F};
+
+// parse a gcode number ([-+]digits[.digits], no exponent) starting at p, leading whitespace is skipped like strtof does
+// returns a pointer past the number, or p if there is no number there
+static const char *parse_number(const char *p, const char *end, float &value)
+{
+    const char *s= p;
+    while(s < end && is_whitespace(*s)) ++s;
+
+    bool neg= false;
+    if(s < end && (*s == '-' || *s == '+')) {
+        neg= (*s == '-');
+        ++s;
+    }
+
+    // accumulate up to 9 significant digits as an integer then scale once, exact for the typical gcode number
+    uint32_t mantissa= 0;
+    int exponent= 0;
+    bool digits= false;
+    for(; s < end && is_digit(*s); ++s) {
+        digits= true;
+        if(mantissa < 100000000) mantissa= mantissa * 10 + (*s - '0');
+        else ++exponent;
+    }
+    if(s < end && *s == '.') {
+        ++s;
+        for(; s < end && is_digit(*s); ++s) {
+            digits= true;
+            if(mantissa < 100000000) {
+                mantissa= mantissa * 10 + (*s - '0');
+                --exponent;
+            }
         }
     }
-    if(ptr != nullptr) *ptr= nullptr;
-    return 0;
+
+    if(!digits) return p;
+
+    value= Gcode::decimal_to_float(neg ? -(int32_t)mantissa : mantissa, exponent);
+    return s;
 }
 
-int Gcode::get_int( char letter, char **ptr ) const
+// mantissa * 10^exponent, done the same way for text and for values that were tokenized offline so they are identical
+float Gcode::decimal_to_float(int32_t mantissa, int exponent)
 {
-    const char *cs = command;
-    char *cn = NULL;
-    for (; *cs; cs++) {
-        if( letter == *cs ) {
-            cs++;
-            int r = strtol(cs, &cn, 10);
-            if(ptr != nullptr) *ptr= cn;
-            if (cn > cs)
-                return r;
-        }
+    float v= mantissa < 0 ? -mantissa : mantissa;
+    while(exponent < -10) { v /= 1E10F; exponent += 10; }
+    while(exponent > 10) { v *= 1E10F; exponent -= 10; }
+    if(exponent < 0) v /= powers_of_ten[-exponent];
+    else if(exponent > 0) v *= powers_of_ten[exponent];
+
+    return mantissa < 0 ? -v : v;
+}
+
+// parse an unsigned integer, returns a pointer past the digits
+static const char *parse_uint(const char *p, const char *end, unsigned int &value)
+{
+    while(p < end && is_whitespace(*p)) ++p;
+    value= 0;
+    for(; p < end && is_digit(*p); ++p) {
+        value= value * 10 + (*p - '0');
     }
-    if(ptr != nullptr) *ptr= nullptr;
-    return 0;
+    return p;
 }
 
-uint32_t Gcode::get_uint( char letter, char **ptr ) const
+// index of the first word with the given letter, -1 if none
+int Gcode::find_word(char letter) const
 {
-    const char *cs = command;
-    char *cn = NULL;
-    for (; *cs; cs++) {
-        if( letter == *cs ) {
-            cs++;
-            int r = strtoul(cs, &cn, 10);
-            if(ptr != nullptr) *ptr= cn;
-            if (cn > cs)
-                return r;
-        }
+    for (int i = 0; i < num_words; ++i) {
+        if(words[i].letter == letter) return i;
     }
-    if(ptr != nullptr) *ptr= nullptr;
-    return 0;
+    return -1;
+}
+
+// index of the first word with the given letter that has a value, -1 if none
+int Gcode::find_value(char letter) const
+{
+    for (int i = 0; i < num_words; ++i) {
+        if(words[i].letter == letter && words[i].has_value) return i;
+    }
+    return -1;
+}
+
+// Retrieve the value for a given letter
+float Gcode::get_value( char letter ) const
+{
+    int i= find_value(letter);
+    return i < 0 ? 0 : words[i].value;
+}
+
+// integers are parsed from the text so large values (eg packed floats in M561) are exact
+int Gcode::get_int( char letter ) const
+{
+    int i= find_value(letter);
+    if(i < 0) return 0;
+    if(words[i].pos == NO_POS) return words[i].value;
+    return strtol(&command[words[i].pos + 1], nullptr, 10);
+}
+
+uint32_t Gcode::get_uint( char letter ) const
+{
+    int i= find_value(letter);
+    if(i < 0) return 0;
+    if(words[i].pos == NO_POS) return words[i].value;
+    return strtoul(&command[words[i].pos + 1], nullptr, 10);
 }
 
 int Gcode::get_num_args() const
 {
     int count = 0;
-    for(size_t i = stripped?0:1; i < strlen(command); i++) {
-        if( this->command[i] >= 'A' && this->command[i] <= 'Z' ) {
-            if(this->command[i] == 'T') continue;
+    for(int i = stripped?0:1; i < num_words; i++) {
+        char c= words[i].letter;
+        if( c >= 'A' && c <= 'Z' ) {
+            if(c == 'T') continue;
             count++;
         }
     }
@@ -145,8 +243,8 @@ int Gcode::get_num_args() const
 std::map<char,float> Gcode::get_args() const
 {
     std::map<char,float> m;
-    for(size_t i = stripped?0:1; i < strlen(command); i++) {
-        char c= this->command[i];
+    for(int i = stripped?0:1; i < num_words; i++) {
+        char c= words[i].letter;
         if( c >= 'A' && c <= 'Z' ) {
             if(c == 'T') continue;
             m[c]= get_value(c);
@@ -158,8 +256,8 @@ std::map<char,float> Gcode::get_args() const
 std::map<char,int> Gcode::get_args_int() const
 {
     std::map<char,int> m;
-    for(size_t i = stripped?0:1; i < strlen(command); i++) {
-        char c= this->command[i];
+    for(int i = stripped?0:1; i < num_words; i++) {
+        char c= words[i].letter;
         if( c >= 'A' && c <= 'Z' ) {
             if(c == 'T') continue;
             m[c]= get_int(c);
@@ -168,75 +266,130 @@ std::map<char,int> Gcode::get_args_int() const
     return m;
 }
 
-// Cache some of this command's properties, so we don't have to parse the string every time we want to look at them
-void Gcode::prepare_cached_values(bool strip)
+// M codes whose argument is free text (a filename or a message), it is not split into words
+static bool is_text_mcode(unsigned int m)
 {
-    char *p= nullptr;
-    if( this->has_letter('G') ) {
-        this->has_g = true;
-        this->g = this->get_int('G', &p);
+    return m == 23 || m == 28 || m == 30 || m == 32 || m == 117;
+}
+
+// Tokenize the line into words in one pass, and cache some of this command's properties, so we don't have to parse the string every time we want to look at them
+void Gcode::prepare_cached_values(const char *line, size_t len, bool strip)
+{
+    const char *end= line + len;
+
+    // the checksum ends the line, it is looked for on its own and always gets a word so a long message can not hide it
+    const char *chk= static_cast<const char *>(memchr(line, '*', len));
+    const char *words_end= chk != nullptr ? chk : end;
+    const int max_words= chk != nullptr ? GCODE_MAX_WORDS - 1 : GCODE_MAX_WORDS;
+
+    // split into words, a word is an upper case letter optionally followed by a number
+    // where each word and its number are in the line is kept until we know where the command text starts
+    const char *src[GCODE_MAX_WORDS];
+    const char *src_end[GCODE_MAX_WORDS];
+    num_words= 0;
+    bool text= false;
+    const char *p= line;
+    while(p < words_end && num_words < max_words) {
+        char c= *p;
+        if(c >= 'A' && c <= 'Z') {
+            word_t &w= words[num_words];
+            w.letter= c;
+            w.value= 0;
+            const char *e= parse_number(p + 1, words_end, w.value);
+            w.has_value= (e != p + 1);
+            src[num_words]= p;
+            src_end[num_words]= e;
+            ++num_words;
+            p= e;
+            // the rest is a filename or message
+            if(c == 'M' && w.has_value && is_text_mcode(w.value)) {
+                text= true;
+                break;
+            }
+        } else {
+            ++p;
+        }
+    }
+
+    if(!text) {
+        // a word that did not fit would be lost, so the whole command is refused rather than run without it
+        for (; p < words_end; ++p) {
+            if(*p >= 'A' && *p <= 'Z') {
+                this->is_error= true;
+                this->txt_after_ok= "too many words in command";
+                break;
+            }
+        }
+    }
 
-    } else {
-        this->has_g = false;
+    if(chk != nullptr) {
+        word_t &w= words[num_words];
+        w.letter= '*';
+        w.value= 0;
+        const char *e= parse_number(chk + 1, end, w.value);
+        w.has_value= (e != chk + 1);
+        src[num_words]= chk;
+        src_end[num_words]= e;
+        ++num_words;
     }
 
-    if( this->has_letter('M') ) {
-        this->has_m = true;
-        this->m = this->get_int('M', &p);
+    // the G and M numbers, the M overrides G as to where the command ends
+    p= nullptr;
+    int gi= find_value('G');
+    this->has_g= find_word('G') >= 0;
+    if(gi >= 0) {
+        p= parse_uint(src[gi] + 1, end, this->g);
+    }
 
-    } else {
-        this->has_m = false;
+    int mi= find_value('M');
+    this->has_m= find_word('M') >= 0;
+    if(mi >= 0) {
+        p= parse_uint(src[mi] + 1, end, this->m);
     }
 
     if(has_g || has_m) {
         // look for subcode and extract it
-        if(p != nullptr && *p == '.') {
-            this->subcode = strtoul(p+1, &p, 10);
+        if(p != nullptr && p < end && *p == '.') {
+            unsigned int sc;
+            p= parse_uint(p + 1, end, sc);
+            this->subcode= sc;
 
         }else{
             this->subcode= 0;
         }
     }
 
-    if(!strip) return;
+    // remove the Gxxx or Mxxx from the command, it starts at the end of the numeric value
+    const char *start= (strip && p != nullptr) ? p : line;
 
-    // remove the Gxxx or Mxxx from string
-    if (p != nullptr) {
-        char *n= strdup(p); // create new string starting at end of the numeric value
-        free(command);
-        command= n;
+    size_t n= end - start;
+    if(!set_command(start, n)) {
+        n= GCODE_MAX_LENGTH - 1;
+        this->is_error= true;
+        this->txt_after_ok= "command too long";
     }
+
+    // drop the words that were stripped, and set the position of the rest within the command text
+    uint8_t k= 0;
+    for (int i = 0; i < num_words; ++i) {
+        if(src[i] < start) continue;
+        words[k]= words[i];
+        // only if the whole number made it into the text
+        words[k].pos= ((size_t)(src_end[i] - start) <= n) ? src[i] - start : NO_POS;
+        ++k;
+    }
+    num_words= k;
 }
 
 // strip off X Y Z I J K parameters if G0/1/2/3
 void Gcode::strip_parameters()
 {
     if(has_g && g < 4){
-        // strip the command of the XYZIJK parameters
-        string newcmd;
-        char *cn= command;
-        // find the start of each parameter
-        char *pch= strpbrk(cn, "XYZIJK");
-        while (pch != nullptr) {
-            if(pch > cn) {
-                // copy non parameters to new string
-                newcmd.append(cn, pch-cn);
-            }
-            // find the end of the parameter and its value
-            char *eos;
-            strtof(pch+1, &eos);
-            cn= eos; // point to end of last parameter
-            pch= strpbrk(cn, "XYZIJK"); // find next parameter
+        uint8_t k= 0;
+        for (int i = 0; i < num_words; ++i) {
+            if(strchr("XYZIJK", words[i].letter) != nullptr) continue;
+            words[k++]= words[i];
         }
-        // append anything left on the line
-        newcmd.append(cn);
-
-        // strip whitespace to save even more, this causes problems so don't do it
-        //newcmd.erase(std::remove_if(newcmd.begin(), newcmd.end(), ::isspace), newcmd.end());
-
-        // release the old one
-        free(command);
-        // copy the new shortened one
-        command= strdup(newcmd.c_str());
+        num_words= k;
     }
 }
@@ -10,24 +10,37 @@
 #define GCODE_H
 #include <string>
 #include <map>
+#include <stdint.h>
 
 using std::string;
 
 class StreamOutput;
 
+// maximum number of letter/value words per command, a command with more is an error (the checksum always has room)
+#define GCODE_MAX_WORDS 16
+// command text up to this long is kept in the Gcode itself, longer text (eg a long SD path) goes on the heap
+#define GCODE_MAX_LENGTH 128
+
 // Object to represent a Gcode command
+// The line is tokenized once when constructed into a fixed array of words, no heap is used unless the text is long
 class Gcode {
     public:
+        Gcode(const char *, StreamOutput*, bool strip=true);
+        Gcode(const char *, size_t len, StreamOutput*, bool strip=true);
         Gcode(const string&, StreamOutput*, bool strip=true);
+        // an already tokenized command, set g or m and add the words, there is no command text
+        Gcode(StreamOutput*);
+        ~Gcode();
         Gcode(const Gcode& to_copy);
         Gcode& operator= (const Gcode& to_copy);
-        ~Gcode();
+        bool add_word(char letter, bool has_value, float value);
+        static float decimal_to_float(int32_t mantissa, int exponent);
 
         const char* get_command() const { return command; }
-        bool has_letter ( char letter ) const;
-        float get_value ( char letter, char **ptr= nullptr ) const;
-        int get_int ( char letter, char **ptr= nullptr ) const;
-        uint32_t get_uint ( char letter, char **ptr= nullptr ) const;
+        bool has_letter ( char letter ) const { return find_word(letter) >= 0; }
+        float get_value ( char letter ) const;
+        int get_int ( char letter ) const;
+        uint32_t get_uint ( char letter ) const;
         int get_num_args() const;
         std::map<char,float> get_args() const;
         std::map<char,int> get_args_int() const;
@@ -50,7 +63,22 @@ class Gcode {
         string txt_after_ok;
 
     private:
-        void prepare_cached_values(bool strip=true);
-        char *command;
+        struct word_t {
+            char letter;
+            bool has_value;
+            uint16_t pos;   // index of the letter in command, NO_POS if it is not in the text
+            float value;
+        };
+        static const uint16_t NO_POS= 0xFFFF;
+
+        void prepare_cached_values(const char *line, size_t len, bool strip);
+        bool set_command(const char *text, size_t len);
+        int find_word(char letter) const;
+        int find_value(char letter) const;
+
+        word_t words[GCODE_MAX_WORDS];
+        uint8_t num_words;
+        char *command;  // short_command, or the heap if the text did not fit
+        char short_command[GCODE_MAX_LENGTH];
 };
 #endif
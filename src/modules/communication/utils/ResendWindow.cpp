@@ -0,0 +1,54 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "ResendWindow.h"
+
+#include <string.h>
+
+void ResendWindow::set_line(int line)
+{
+    // the next line is never negative, so recent_checksums is only ever indexed by a line >= 0
+    current_line = line < -1 ? -1 : line;
+    resend_pending = false;
+    last_resend = 0;
+    memset(recent_checksums, 0xFF, sizeof(recent_checksums));
+}
+
+ResendWindow::ACTION ResendWindow::check(int ln, int chksum, bool good, uint32_t now)
+{
+    int nextline = current_line + 1;
+
+    // line numbers are never negative, a line that says so is as bad as one with the wrong checksum
+    if(ln < 0) good = false;
+
+    if(good && ln == nextline) {
+        current_line = ln;
+        recent_checksums[ln % GCODE_RESEND_WINDOW] = chksum;
+        resend_pending = false;
+        return RUN;
+    }
+
+    if(good && ln < nextline && chksum >= 0) {
+        // sent again by a host that went back further than the line asked for
+        if(nextline - ln <= GCODE_RESEND_WINDOW && recent_checksums[ln % GCODE_RESEND_WINDOW] == (uint16_t)chksum) {
+            return DUPLICATE;
+        }
+        return MISMATCH;
+    }
+
+    // a bad line, one after a line that was lost, or an old line without a checksum that can not be matched, all get
+    // told which line is expected. The line asked for arriving bad again, or a rs that was lost on the
+    // way, needs another rs, but the lines already sent after the bad one only get one now and then
+    if(!resend_pending || ln == nextline || (uint32_t)(now - last_resend) >= GCODE_RESEND_INTERVAL_US) {
+        resend_pending = true;
+        last_resend = now;
+        return RESEND;
+    }
+    return DROP;
+}
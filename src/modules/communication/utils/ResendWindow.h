@@ -0,0 +1,49 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef RESENDWINDOW_H
+#define RESENDWINDOW_H
+
+#include <stdint.h>
+
+// number of accepted numbered lines whose checksums are kept
+#define GCODE_RESEND_WINDOW 32
+// while waiting for a resend, lines that are not the one asked for get another rs at most this often
+#define GCODE_RESEND_INTERVAL_US 100000
+
+// Decides what to do with each numbered line (N<line> ... *<checksum>) from a host that sends many lines ahead.
+// After a bad line a resend is asked for, the host goes back to that line and the lines it had already sent after it
+// are dropped. The checksums of the last GCODE_RESEND_WINDOW lines are kept so a line sent again is recognised.
+class ResendWindow {
+    public:
+        enum ACTION {
+            RUN,        // the next line, run it
+            DUPLICATE,  // a line that was already run, reply ok
+            MISMATCH,   // an old line number with a different checksum, an error
+            RESEND,     // reply rs with next_line()
+            DROP        // waiting for a resend, drop it without a reply
+        };
+
+        ResendWindow() { set_line(-1); }
+        // M110, the next line is line + 1
+        void set_line(int line);
+        int next_line() const { return current_line + 1; }
+
+        // ln and chksum as sent (chksum -1 if there was none), good if the checksum matched, now in us
+        ACTION check(int ln, int chksum, bool good, uint32_t now);
+
+    private:
+        int current_line;
+        uint32_t last_resend;
+        // checksums of accepted lines, indexed by line number
+        uint16_t recent_checksums[GCODE_RESEND_WINDOW];
+        bool resend_pending;
+};
+
+#endif
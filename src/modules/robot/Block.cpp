@@ -66,8 +66,10 @@ void Block::clear()
     recalculate_flag    = false;
     nominal_length_flag = false;
     max_entry_speed     = 0.0F;
+    plan_count          = 0;
     is_ticking          = false;
     is_g123             = false;
+    is_dwell            = false;
     locked              = false;
     s_value             = 0.0F;
 
@@ -138,6 +140,11 @@ void Block::calculate_trapezoid( float entryspeed, float exitspeed )
     // if block is currently executing, don't touch anything!
     if (is_ticking) return;
 
+    // a dwell has no trapezoid, its total_move_ticks is already set
+    if (is_dwell) return;
+
+    if(plan_count < 255) plan_count++;
+
     float initial_rate = this->nominal_rate * (entryspeed / this->nominal_speed); // steps/sec
     float final_rate = this->nominal_rate * (exitspeed / this->nominal_speed);
     //printf("Initial rate: %f, final_rate: %f\n", initial_rate, final_rate);
@@ -46,6 +46,7 @@ class Block {
         float maximum_rate;
 
         float max_entry_speed;
+        uint8_t plan_count;       // times the trapezoid was calculated, more than once means it was replanned while queued
 
         // this is tick info needed for this block. applies to all motors
         uint32_t accelerate_until;
@@ -76,6 +77,7 @@ class Block {
             bool is_ready:1;
             bool primary_axis:1;                 // set if this move is a primary axis
             bool is_g123:1;                      // set if this is a G1, G2 or G3
+            bool is_dwell:1;                     // set if this is a G4 dwell, it moves nothing and just lasts total_move_ticks
             volatile bool is_ticking:1;          // set when this block is being actively ticked by the stepticker
             volatile bool locked:1;              // set to true when the critical data is being updated, stepticker will have to skip if this is set
             uint16_t s_value:12;                 // for laser 1.11 Fixed point
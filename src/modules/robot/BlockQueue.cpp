@@ -5,6 +5,21 @@
 #include "cmsis.h"
 #include "platform_memory.h"
 
+// the ring goes in AHB0, or in AHB1 if it does not fit there so a large queue can be used
+static Block *alloc_ring(unsigned int length)
+{
+    void *v= AHB0.alloc(sizeof(Block) * length);
+    if(v == nullptr) v= AHB1.alloc(sizeof(Block) * length);
+    if(v == nullptr) return nullptr;
+    return new(v) Block[length];
+}
+
+static void free_ring(Block *ring)
+{
+    if(AHB0.has(ring)) AHB0.dealloc(ring); // delete [] ring;
+    else AHB1.dealloc(ring);
+}
+
 /*
  * constructors
  */
@@ -20,10 +35,8 @@ BlockQueue::BlockQueue(unsigned int length)
 {
     head_i = tail_i = 0;
     isr_tail_i = tail_i;
-    void *v= AHB0.alloc(sizeof(Block) * length);
-    ring = new(v) Block[length];
-    // TODO: handle allocation failure
-    this->length = length;
+    ring = alloc_ring(length);
+    this->length = (ring != nullptr) ? length : 0;
 }
 
 /*
@@ -35,7 +48,7 @@ BlockQueue::~BlockQueue()
     head_i = tail_i = length = 0;
     isr_tail_i = tail_i;
     if(ring != nullptr)
-        AHB0.dealloc(ring); // delete [] ring;
+        free_ring(ring);
     ring = nullptr;
 }
 
@@ -169,7 +182,7 @@ bool BlockQueue::resize(unsigned int length)
                 __enable_irq();
 
                 if (ring != nullptr)
-                    AHB0.dealloc(ring); // delete [] ring;
+                    free_ring(ring);
                 ring = nullptr;
 
                 return true;
@@ -181,8 +194,7 @@ bool BlockQueue::resize(unsigned int length)
         }
 
         // Note: we don't use realloc so we can fall back to the existing ring if allocation fails
-        void *v= AHB0.alloc(sizeof(Block) * length);
-        Block* newring = new(v) Block[length];
+        Block* newring = alloc_ring(length);
 
         if (newring != nullptr)
         {
@@ -199,14 +211,14 @@ bool BlockQueue::resize(unsigned int length)
                 __enable_irq();
 
                 if (oldring != nullptr)
-                    AHB0.dealloc(oldring); // delete [] oldring;
+                    free_ring(oldring);
 
                 return true;
             }
 
             __enable_irq();
 
-            AHB0.dealloc(newring); // delete [] newring;
+            free_ring(newring);
         }
     }
 
@@ -22,14 +22,35 @@
 #include "StepTicker.h"
 #include "Robot.h"
 #include "StepperMotor.h"
+#include "PublicDataRequest.h"
+#include "ConveyorPublicAccess.h"
+#include "StreamOutput.h"
+#include "platform_memory.h"
 
 #include <functional>
 #include <vector>
+#include <string.h>
 
 #include "mbed.h"
 
 #define planner_queue_size_checksum CHECKSUM("planner_queue_size")
 #define queue_delay_time_ms_checksum CHECKSUM("queue_delay_time_ms")
+#define queue_adaptive_delay_checksum CHECKSUM("queue_adaptive_delay")
+#define block_trace_size_checksum CHECKSUM("block_trace_size")
+#define planner_queue_time_ms_checksum CHECKSUM("planner_queue_time_ms")
+#define planner_queue_distance_checksum CHECKSUM("planner_queue_distance")
+
+// a gap between blocks longer than this is the machine being idle rather than starved
+#define UNDERRUN_MAX_GAP_SECONDS 2
+
+// adaptive start: blocks arriving further apart than this start a new burst of input
+#define PREFILL_MAX_INTERVAL_US 1000000
+// start if no block arrived for twice the usual interval, but never wait less than this
+#define PREFILL_MIN_IDLE_US 5000
+// blocks needed before we start while input is still arriving
+#define PREFILL_MIN_BLOCKS 4
+// and the longest we ever wait
+#define PREFILL_MAX_WAIT_US 1000000
 
 /*
  * The conveyor holds the queue of blocks, takes care of creating them, and starting the executing chain of blocks
@@ -64,24 +85,64 @@ Conveyor::Conveyor()
     running = false;
     allow_fetch = false;
     flush= false;
+    adaptive_delay= false;
+    reset_health();
+}
+
+// the time a block is expected to take, a dwell moves nothing and just has its ticks
+static float block_secs(const Block *block)
+{
+    if(block->is_dwell) return block->total_move_ticks / THEKERNEL->step_ticker->get_frequency();
+    return block->nominal_speed > 0 ? block->millimeters / block->nominal_speed : 0;
 }
 
 void Conveyor::on_module_loaded()
 {
     register_for_event(ON_IDLE);
     register_for_event(ON_HALT);
+    register_for_event(ON_GET_PUBLIC_DATA);
+    register_for_event(ON_SET_PUBLIC_DATA);
 
     // Attach to the end_of_move stepper event
     //THEKERNEL->step_ticker->finished_fnc = std::bind( &Conveyor::all_moves_finished, this);
     queue_size = THEKERNEL->config->value(planner_queue_size_checksum)->by_default(32)->as_number();
     queue_delay_time_ms = THEKERNEL->config->value(queue_delay_time_ms_checksum)->by_default(100)->as_number();
+    // start moving based on how fast blocks are arriving rather than after a fixed queue_delay_time_ms
+    adaptive_delay = THEKERNEL->config->value(queue_adaptive_delay_checksum)->by_default(false)->as_bool();
+    trace_size = THEKERNEL->config->value(block_trace_size_checksum)->by_default(0)->as_number();
+    // look ahead by time or distance rather than by number of blocks, planner_queue_size should then be raised to allow for short segments
+    queue_time_horizon = THEKERNEL->config->value(planner_queue_time_ms_checksum)->by_default(0)->as_number() / 1000.0F;
+    queue_distance_horizon = THEKERNEL->config->value(planner_queue_distance_checksum)->by_default(0)->as_number();
 }
 
 // we allocate the queue here after config is completed so we do not run out of memory during config
 void Conveyor::start(uint8_t n)
 {
     Block::init(n); // set the number of motors which determines how big the tick info vector is
-    queue.resize(queue_size);
+    // if there is not enough AHB memory for the configured size use the largest that fits
+    size_t n_blocks= queue_size;
+    bool ok;
+    while(!(ok= queue.resize(n_blocks)) && n_blocks > 2) {
+        n_blocks /= 2;
+    }
+    if(!ok) {
+        THEKERNEL->streams->printf("Not enough AHB memory for a planner queue\n");
+    } else if(n_blocks != queue_size) {
+        THEKERNEL->streams->printf("Not enough AHB memory for a planner queue of %u blocks, using %u\n", (unsigned)queue_size, (unsigned)n_blocks);
+        queue_size= n_blocks;
+    }
+
+    if(trace_size > 0) {
+        // the block queue has first call on AHB0
+        void *v= AHB1.alloc(sizeof(block_trace_t) * trace_size);
+        if(v == nullptr) v= AHB0.alloc(sizeof(block_trace_t) * trace_size);
+        if(v == nullptr) {
+            THEKERNEL->streams->printf("Not enough AHB memory for a block trace of %u blocks\n", trace_size);
+        } else {
+            trace= (block_trace_t *)v;
+        }
+    }
+
     running = true;
 }
 
@@ -106,12 +167,62 @@ void Conveyor::on_idle(void*)
             // Cleanly delete block
             Block* block = queue.tail_ref();
             //block->debug();
+            queued_mm -= block->millimeters;
+            queued_secs -= block_secs(block);
             block->clear();
             queue.consume_tail();
+            if(queue.is_empty()) {
+                // do not let rounding errors accumulate
+                queued_mm= 0;
+                queued_secs= 0;
+            }
         }
     }
 }
 
+void Conveyor::on_get_public_data(void *argument)
+{
+    PublicDataRequest *pdr = static_cast<PublicDataRequest *>(argument);
+
+    if(!pdr->starts_with(conveyor_checksum)) return;
+
+    if(pdr->second_element_is(health_checksum)) {
+        // provided by caller
+        get_health(*static_cast<pad_conveyor_health *>(pdr->get_data_ptr()));
+        pdr->set_taken();
+    }
+}
+
+void Conveyor::on_set_public_data(void *argument)
+{
+    PublicDataRequest *pdr = static_cast<PublicDataRequest *>(argument);
+
+    if(!pdr->starts_with(conveyor_checksum)) return;
+
+    if(pdr->second_element_is(reset_health_checksum)) {
+        reset_health();
+        pdr->set_taken();
+    }
+}
+
+void Conveyor::get_health(pad_conveyor_health& h) const
+{
+    __disable_irq();
+    h.blocks= health.blocks;
+    h.underruns= health.underruns;
+    h.starved_ms= health.starved_ticks * 1000.0F / THEKERNEL->step_ticker->get_frequency();
+    h.locked_refusals= health.locked_refusals;
+    h.average_depth= health.blocks > 0 ? (float)health.depth_sum / health.blocks : 0;
+    __enable_irq();
+}
+
+void Conveyor::reset_health()
+{
+    __disable_irq();
+    memset(&health, 0, sizeof(health));
+    __enable_irq();
+}
+
 // see if we are idle
 // this checks the block queue is empty, and that the step queue is empty and
 // checks that all motors are no longer moving
@@ -155,7 +266,7 @@ void Conveyor::wait_for_idle(bool wait_for_motors)
 void Conveyor::queue_head_block()
 {
     // upstream caller will block on this until there is room in the queue
-    while (queue.is_full() && !THEKERNEL->is_halted()) {
+    while ((queue.is_full() || is_horizon_reached()) && !THEKERNEL->is_halted()) {
         //check_queue();
         THEKERNEL->call_event(ON_IDLE, this); // will call check_queue();
     }
@@ -167,12 +278,49 @@ void Conveyor::queue_head_block()
         return; // if we got a halt then we are done here
     }
 
+    Block *block= queue.head_ref();
+    float secs= block_secs(block);
+    queued_mm += block->millimeters;
+    queued_secs += secs;
     queue.produce_head();
 
+    // keep a running average of the block arrival rate, a long gap is a new burst of input so is not counted
+    uint32_t now= us_ticker_read();
+    uint32_t interval= now - last_block_us;
+    last_block_us= now;
+    if(interval < PREFILL_MAX_INTERVAL_US) {
+        avg_block_interval += (interval / 1000000.0F - avg_block_interval) * 0.25F;
+        avg_block_secs += (secs - avg_block_secs) * 0.25F;
+    }
+
     // not sure if this is the correct place but we need to turn on the motors if they were not already on
     THEKERNEL->call_event(ON_ENABLE, (void*)1); // turn all enable pins on
 }
 
+// true if there is already as much motion queued as the configured look ahead
+bool Conveyor::is_horizon_reached() const
+{
+    return (queue_time_horizon > 0 && queued_secs >= queue_time_horizon) ||
+           (queue_distance_horizon > 0 && queued_mm >= queue_distance_horizon);
+}
+
+// decide if enough motion is queued to start moving without running out, based on how fast blocks are arriving
+bool Conveyor::is_prefilled(uint32_t waited_us) const
+{
+    // nothing new for a while, probably a jog or MDI command so do not keep it waiting
+    uint32_t idle= std::max((uint32_t)(avg_block_interval * 2000000.0F), (uint32_t)PREFILL_MIN_IDLE_US);
+    if(us_ticker_read() - last_block_us >= idle) return true;
+
+    // while blocks are still arriving, input that is slower than the motion it describes needs more
+    // queued up front, up to queue_delay_time_ms worth of motion when it is much slower
+    float rate= avg_block_interval > 0 ? avg_block_secs / avg_block_interval : 1.0F;
+    float needed= (queue_delay_time_ms / 1000.0F) * (1.0F - std::min(rate, 1.0F));
+    unsigned int n= (queue.head_i + queue.length - queue.tail_i) % queue.length;
+    if(n >= PREFILL_MIN_BLOCKS && queued_secs >= needed) return true;
+
+    return waited_us >= PREFILL_MAX_WAIT_US;
+}
+
 void Conveyor::check_queue(bool force)
 {
     static uint32_t last_time_check = us_ticker_read();
@@ -185,7 +333,8 @@ void Conveyor::check_queue(bool force)
 
     // if we have been waiting for more than the required waiting time and the queue is not empty, or the queue is full, then allow stepticker to get the tail
     // we do this to allow an idle system to pre load the queue a bit so the first few blocks run smoothly.
-    if(force || queue.is_full() || (us_ticker_read() - last_time_check) >= (queue_delay_time_ms * 1000)) {
+    uint32_t waited= us_ticker_read() - last_time_check;
+    if(force || queue.is_full() || is_horizon_reached() || (adaptive_delay ? is_prefilled(waited) : waited >= (queue_delay_time_ms * 1000))) {
         last_time_check = us_ticker_read(); // reset timeout
         if(!flush) allow_fetch = true;
         return;
@@ -200,11 +349,16 @@ bool Conveyor::get_next_block(Block **block)
         while (queue.isr_tail_i != queue.head_i) {
             queue.isr_tail_i = queue.next(queue.isr_tail_i);
         }
+        // the blocks they were waiting on will never run
+        action_tail= action_head;
     }
 
     // default the feerate to zero if there is no block available
     this->current_feedrate= 0;
 
+    // the step ticker calls this every tick while it has nothing to do
+    if(health.starving) health.gap_ticks++;
+
     if(THEKERNEL->is_halted() || queue.isr_tail_i == queue.head_i) return false; // we do not have anything to give
 
     // wait for queue to fill up, optimizes planning
@@ -219,17 +373,48 @@ bool Conveyor::get_next_block(Block **block)
         b->recalculate_flag= false;
         this->current_feedrate= b->nominal_speed;
         *block= b;
+
+        if(health.starving) {
+            // the first call is in the same tick the last block finished, so that one is not a gap
+            if(health.gap_ticks > 1 && health.gap_ticks < UNDERRUN_MAX_GAP_SECONDS * THEKERNEL->step_ticker->get_frequency()) {
+                health.underruns++;
+                health.starved_ticks += health.gap_ticks - 1;
+            }
+            health.starving= false;
+        }
+        health.blocks++;
+        health.refused= false;
+        health.depth_sum += (queue.head_i + queue.length - queue.isr_tail_i) % queue.length;
+        block_start_us= us_ticker_read();
         return true;
     }
 
+    // the step ticker asks every tick, a refusal is only counted once per time the planner held up a block
+    if(!health.refused) {
+        health.refused= true;
+        health.locked_refusals++;
+    }
     return false;
 }
 
 // called from step ticker ISR when block is finished, do not do anything slow here
 void Conveyor::block_finished()
 {
+    if(trace != nullptr) trace_block(queue.item_ref(queue.isr_tail_i));
+
+    // run any actions that were queued behind this block
+    while(action_tail != action_head && actions[action_tail].block_i == queue.isr_tail_i) {
+        action_t& a= actions[action_tail];
+        a.fnc(a.obj, a.value);
+        action_tail= (action_tail + 1) % action_queue_size;
+    }
+
     // we increment the isr_tail_i so we can get the next block
     queue.isr_tail_i= queue.next(queue.isr_tail_i);
+
+    // if the next get_next_block() fails we are waiting for a block
+    health.starving= true;
+    health.gap_ticks= 0;
 }
 
 /*
@@ -252,6 +437,108 @@ void Conveyor::flush_queue()
     flush= false;
 }
 
+// queue an action to run in sync with the motion, this is how M3/M106 etc avoid draining the queue
+void Conveyor::queue_action(action_fnc_t fnc, void *obj, float value)
+{
+    // wait for space in the action queue
+    while(((action_head + 1) % action_queue_size) == action_tail && !THEKERNEL->is_halted()) {
+        THEKERNEL->call_event(ON_IDLE, this);
+    }
+
+    if(!THEKERNEL->is_halted()) {
+        // the step ticker must not finish the last block between checking it and queuing the action
+        __disable_irq();
+        if(queue.isr_tail_i != queue.head_i) {
+            action_t& a= actions[action_head];
+            a.fnc= fnc;
+            a.obj= obj;
+            a.value= value;
+            a.block_i= queue.prev(queue.head_i);
+            action_head= (action_head + 1) % action_queue_size;
+            __enable_irq();
+            return;
+        }
+        __enable_irq();
+    }
+
+    // nothing is queued so there is nothing to wait for
+    fnc(obj, value);
+}
+
+// called from step ticker ISR, records the block that just finished
+void Conveyor::trace_block(const Block *b)
+{
+    block_trace_t& t= trace[trace_count % trace_size];
+    t.start_us= block_start_us;
+    t.total_move_ticks= b->total_move_ticks;
+    t.entry_speed= b->entry_speed;
+    t.exit_speed= b->exit_speed;
+    t.nominal_speed= b->nominal_speed;
+    for (int i = 0; i < k_max_actuators; ++i) {
+        t.steps[i]= i < Block::n_actuators ? (b->direction_bits[i] ? -(int32_t)b->steps[i] : b->steps[i]) : 0;
+    }
+    t.plan_count= b->plan_count;
+    t.flags= (b->primary_axis ? 1 : 0) | (b->is_g123 ? 2 : 0);
+    t.reserved= 0;
+    trace_count++;
+}
+
+// get the i'th oldest entry still in the trace
+bool Conveyor::get_trace(uint32_t i, block_trace_t& t) const
+{
+    bool ok= false;
+    __disable_irq();
+    uint32_t n= std::min(trace_count, (uint32_t)trace_size);
+    if(i < n) {
+        t= trace[(trace_count - n + i) % trace_size];
+        ok= true;
+    }
+    __enable_irq();
+    return ok;
+}
+
+void Conveyor::reset_trace()
+{
+    __disable_irq();
+    trace_count= 0;
+    __enable_irq();
+}
+
+// binary file is a header of "SBT1", the record size, number of actuators and number of records as uint32_t
+// followed by the records oldest first, all little endian
+bool Conveyor::save_trace(const char *filename) const
+{
+    FILE *fp= fopen(filename, "w");
+    if(fp == NULL) return false;
+
+    uint32_t header[4]= {0x31544253, sizeof(block_trace_t), Block::n_actuators, std::min(trace_count, (uint32_t)trace_size)};
+    fwrite(header, sizeof(header), 1, fp);
+    block_trace_t t;
+    for (uint32_t i = 0; get_trace(i, t); ++i) {
+        fwrite(&t, sizeof(t), 1, fp);
+    }
+    fclose(fp);
+    return true;
+}
+
+// same as the file but hex encoded, one record per line
+void Conveyor::dump_trace(StreamOutput *stream) const
+{
+    stream->printf("SBT1 %u %u %lu\n", sizeof(block_trace_t), Block::n_actuators, std::min(trace_count, (uint32_t)trace_size));
+    block_trace_t t;
+    char buf[sizeof(block_trace_t) * 2 + 2];
+    for (uint32_t i = 0; get_trace(i, t); ++i) {
+        const uint8_t *p= (const uint8_t *)&t;
+        for (size_t j = 0; j < sizeof(t); ++j) {
+            buf[j * 2]= "0123456789ABCDEF"[p[j] >> 4];
+            buf[j * 2 + 1]= "0123456789ABCDEF"[p[j] & 0x0F];
+        }
+        buf[sizeof(t) * 2]= '\n';
+        buf[sizeof(t) * 2 + 1]= '\0';
+        stream->puts(buf);
+    }
+}
+
 // Debug function
 void Conveyor::dump_queue()
 {
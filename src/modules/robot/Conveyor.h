@@ -9,8 +9,11 @@
 
 #include "libs/Module.h"
 #include "BlockQueue.h"
+#include "ActuatorCoordinates.h"
 
 class Block;
+class StreamOutput;
+struct pad_conveyor_health;
 
 class Conveyor : public Module
 {
@@ -21,10 +24,12 @@ public:
     void on_module_loaded(void);
     void on_idle(void *);
     void on_halt(void *);
+    void on_get_public_data(void *);
+    void on_set_public_data(void *);
 
     void wait_for_idle(bool wait_for_motors=true);
     bool is_queue_empty() { return queue.is_empty(); };
-    bool is_queue_full() { return queue.is_full(); };
+    bool is_queue_full() { return queue.is_full() || is_horizon_reached(); };
     bool is_idle() const;
 
     // returns next available block writes it to block and returns true
@@ -34,24 +39,95 @@ public:
     void dump_queue(void);
     void flush_queue(void);
     float get_current_feedrate() const { return current_feedrate; }
+    float get_queued_secs() const { return queued_secs; }
+
+    void get_health(pad_conveyor_health& h) const;
+    void reset_health();
+
+    // optional trace of the last completed blocks, to look at planner decisions after the fact
+    struct block_trace_t {
+        uint32_t start_us;         // us_ticker time the step ticker started the block
+        uint32_t total_move_ticks;
+        float entry_speed;         // as planned in mm/sec
+        float exit_speed;
+        float nominal_speed;
+        int32_t steps[k_max_actuators]; // negative when moving in the negative direction
+        uint8_t plan_count;        // more than one means it was replanned while queued
+        uint8_t flags;             // bit 0 primary axis, bit 1 G1/G2/G3
+        uint16_t reserved;
+    };
+    bool is_tracing() const { return trace != nullptr; }
+    bool save_trace(const char *filename) const;
+    void dump_trace(StreamOutput *stream) const;
+    void reset_trace();
+
+    // run fnc(obj, value) when the last block queued so far has finished, or now if nothing is queued.
+    // it is called from the step ticker ISR so it must be quick
+    typedef void (*action_fnc_t)(void *obj, float value);
+    void queue_action(action_fnc_t fnc, void *obj, float value);
 
     friend class Planner; // for queue
 
 private:
     void check_queue(bool force= false);
     void queue_head_block(void);
+    bool is_horizon_reached() const;
+    bool is_prefilled(uint32_t waited_us) const;
 
     using  Queue_t= BlockQueue;
     Queue_t queue;  // Queue of Blocks
 
     uint32_t queue_delay_time_ms;
     size_t queue_size;
+
+    // optionally stop accepting blocks once this much motion is queued, queue_size is then just the hard limit
+    float queue_time_horizon;     // seconds, 0 is disabled
+    float queue_distance_horizon; // mm, 0 is disabled
+    float queued_secs{0};         // estimated time and distance of the blocks in the queue
+    float queued_mm{0};
+
+    // how fast blocks are arriving, used to decide when to start moving
+    uint32_t last_block_us{0};
+    float avg_block_interval{0};  // seconds between blocks
+    float avg_block_secs{0};      // seconds of motion per block
     float current_feedrate{0}; // actual nominal feedrate that current block is running at in mm/sec
 
+    // motion health counters, updated from the step ticker ISR
+    struct {
+        uint32_t blocks;
+        uint32_t underruns;
+        uint32_t starved_ticks;
+        uint32_t locked_refusals;
+        uint32_t gap_ticks;    // ticks since the step ticker ran out of blocks
+        uint64_t depth_sum;
+        bool starving;
+        bool refused;          // the next block was refused as locked since it was last fetched
+    } health;
+
+    void trace_block(const Block *b);
+    bool get_trace(uint32_t i, block_trace_t& t) const;
+    block_trace_t *trace{nullptr};  // ring of trace_size entries in AHB RAM
+    uint32_t trace_count{0};        // entries written since reset, the ring holds the last trace_size of them
+    uint32_t block_start_us{0};
+    uint16_t trace_size{0};
+
+    // actions waiting for the block they follow to finish, filled by queue_action() and emptied in block_finished()
+    struct action_t {
+        action_fnc_t fnc;
+        void *obj;
+        float value;
+        unsigned int block_i;
+    };
+    static const uint8_t action_queue_size= 16;
+    action_t actions[action_queue_size];
+    volatile uint8_t action_head{0};
+    volatile uint8_t action_tail{0};
+
     struct {
         volatile bool running:1;
         volatile bool allow_fetch:1;
         bool flush:1;
+        bool adaptive_delay:1;
     };
 
 };
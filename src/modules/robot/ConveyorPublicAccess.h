@@ -0,0 +1,18 @@
+#ifndef CONVEYORPUBLICACCESS_H
+#define CONVEYORPUBLICACCESS_H
+
+#include <stdint.h>
+
+#define conveyor_checksum         CHECKSUM("conveyor")
+#define health_checksum           CHECKSUM("health")
+#define reset_health_checksum     CHECKSUM("reset_health")
+
+// motion pipeline health since boot or the last reset
+struct pad_conveyor_health {
+    uint32_t blocks;           // blocks started by the step ticker
+    uint32_t underruns;        // times the step ticker ran out of blocks and got a new one soon after
+    uint32_t starved_ms;       // total time spent waiting for a block in those underruns
+    uint32_t locked_refusals;  // times a ready block could not be taken at once as the planner was updating it
+    float average_depth;       // average number of queued blocks when a block is started
+};
+#endif
@@ -22,6 +22,7 @@ using namespace std;
 #include "checksumm.h"
 #include "Robot.h"
 #include "ConfigValue.h"
+#include "StepTicker.h"
 
 #include <math.h>
 #include <algorithm>
@@ -29,6 +30,11 @@ using namespace std;
 #define junction_deviation_checksum    CHECKSUM("junction_deviation")
 #define z_junction_deviation_checksum  CHECKSUM("z_junction_deviation")
 #define minimum_planner_speed_checksum CHECKSUM("minimum_planner_speed")
+#define junction_model_checksum        CHECKSUM("junction_model")
+#define slowdown_time_ms_checksum      CHECKSUM("planner_slowdown_time_ms")
+
+// the most a block will be slowed down when the queue is running dry
+#define SLOWDOWN_MIN_FACTOR 0.5F
 
 // The Planner does the acceleration math for the queue of Blocks ( movements ).
 // It makes sure the speed stays within the configured constraints ( acceleration, junction_deviation, etc )
@@ -46,6 +52,9 @@ void Planner::config_load()
     this->junction_deviation = THEKERNEL->config->value(junction_deviation_checksum)->by_default(0.05F)->as_number();
     this->z_junction_deviation = THEKERNEL->config->value(z_junction_deviation_checksum)->by_default(NAN)->as_number(); // disabled by default
     this->minimum_planner_speed = THEKERNEL->config->value(minimum_planner_speed_checksum)->by_default(0.0f)->as_number();
+    // deviation (default) uses junction_deviation, jerk uses each actuator's max_jerk
+    this->jerk_junction = THEKERNEL->config->value(junction_model_checksum)->by_default("deviation")->as_string() == "jerk";
+    this->slowdown_secs = THEKERNEL->config->value(slowdown_time_ms_checksum)->by_default(0)->as_number() / 1000.0F;
 }
 
 
@@ -123,6 +132,18 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
         block->nominal_rate  = 0;
     }
 
+    // if the host or SD can not keep up the queue runs dry and we would stop between blocks,
+    // so when little motion is queued slow new moves down to keep moving, it is faster overall than stop and go.
+    // Only once the queue has been released to the step ticker, while it is still filling up there is nothing to starve
+    if(slowdown_secs > 0.0F && unit_vec != nullptr && block->nominal_speed > 0.0F && THECONVEYOR->allow_fetch) {
+        float queued = THECONVEYOR->get_queued_secs() + distance / block->nominal_speed;
+        if(queued < slowdown_secs) {
+            float f = std::max(queued / slowdown_secs, SLOWDOWN_MIN_FACTOR);
+            block->nominal_speed *= f;
+            block->nominal_rate *= f;
+        }
+    }
+
     // Compute the acceleration rate for the trapezoid generator. Depending on the slope of the line
     // average travel per step event changes. For a line along one axis the travel per step event
     // is equal to the travel/step in the particular axis. For a 45 degree line the steppers of both
@@ -147,7 +168,12 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
         Block *prev_block = THECONVEYOR->queue.item_ref(THECONVEYOR->queue.prev(THECONVEYOR->queue.head_i));
         float previous_nominal_speed = prev_block->primary_axis ? prev_block->nominal_speed : 0;
 
-        if (junction_deviation > 0.0F && previous_nominal_speed > 0.0F) {
+        if (this->jerk_junction) {
+            if (previous_nominal_speed > 0.0F) {
+                vmax_junction = jerk_junction_speed(prev_block, block, std::min(previous_nominal_speed, block->nominal_speed));
+            }
+
+        } else if (junction_deviation > 0.0F && previous_nominal_speed > 0.0F) {
             // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
             // NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
             float cos_theta = - this->previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
@@ -170,6 +196,15 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
                 }
             }
         }
+
+    } else if (unit_vec == nullptr && !THECONVEYOR->is_queue_empty()) {
+        // an auxiliary (eg E only) move must start from rest after a primary axis move as XYZ have to stop,
+        // but it can carry its speed over from a previous auxiliary move going the same way, so a retract or prime
+        // that was split into several segments does not stop between each of them
+        Block *prev_block = THECONVEYOR->queue.item_ref(THECONVEYOR->queue.prev(THECONVEYOR->queue.head_i));
+        if (!prev_block->primary_axis && prev_block->nominal_speed > 0.0F && is_same_direction(prev_block, block, n_motors)) {
+            vmax_junction = std::min(prev_block->nominal_speed, block->nominal_speed);
+        }
     }
     block->max_entry_speed = vmax_junction;
 
@@ -191,11 +226,10 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     // Always calculate trapezoid for new block
     block->recalculate_flag = true;
 
-    // Update previous path unit_vector and nominal speed
+    // Update previous path unit_vector, an auxiliary move leaves it alone as the next primary move
+    // starts from rest anyway because the previous block is not a primary axis move
     if(unit_vec != nullptr) {
         memcpy(previous_unit_vec, unit_vec, sizeof(previous_unit_vec)); // previous_unit_vec[] = unit_vec[]
-    } else {
-        memset(previous_unit_vec, 0, sizeof(previous_unit_vec));
     }
 
     // Math-heavy re-computing of the whole queue to take the new
@@ -209,6 +243,61 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     return true;
 }
 
+// Queue a block that moves nothing for secs, the moves before it stop and the ones after it start from rest,
+// but the queue does not have to drain to do a G4
+void Planner::append_dwell(float secs)
+{
+    uint32_t ticks= floorf(secs * THEKERNEL->step_ticker->get_frequency());
+    if(ticks == 0) return;
+
+    Block* block = THECONVEYOR->queue.head_ref();
+    block->clear();
+    block->primary_axis= false;
+    block->is_dwell= true;
+    block->total_move_ticks= ticks;
+
+    // the previous block was already planned to stop at the end of the queue, so nothing needs recalculating
+    block->ready();
+
+    THECONVEYOR->queue_head_block();
+}
+
+// Independent axis junction model, each primary actuator can change speed instantly by up to its max_jerk.
+// Its speed is path speed * mm it moves per mm of path, so the path speed is limited by the actuator with the largest change,
+// this lets slow axis like a leadscrew Z protect themselves without limiting X and Y to a single junction deviation
+float Planner::jerk_junction_speed(const Block *prev, const Block *current, float vmax) const
+{
+    for (size_t i = 0; i < N_PRIMARY_AXIS; i++) {
+        float mm_per_step = 1.0F / THEROBOT->actuators[i]->get_steps_per_mm();
+        float r0 = prev->steps[i] * mm_per_step / prev->millimeters;
+        float r1 = current->steps[i] * mm_per_step / current->millimeters;
+        if(prev->direction_bits[i]) r0 = -r0;
+        if(current->direction_bits[i]) r1 = -r1;
+
+        float dr = fabsf(r1 - r0);
+        if(dr > 0.0F) {
+            vmax = std::min(vmax, THEROBOT->actuators[i]->get_max_jerk() / dr);
+        }
+    }
+    return vmax;
+}
+
+// true if both blocks move the same actuators in the same direction and proportions, to within a step
+bool Planner::is_same_direction(const Block *a, const Block *b, uint8_t n_motors) const
+{
+    uint32_t tolerance = std::max(a->steps_event_count, b->steps_event_count);
+    for (size_t i = 0; i < n_motors; i++) {
+        if((a->steps[i] == 0) != (b->steps[i] == 0)) return false;
+        if(a->steps[i] == 0) continue;
+        if(a->direction_bits[i] != b->direction_bits[i]) return false;
+
+        // compare the ratios steps/steps_event_count without dividing
+        int64_t d = (int64_t)a->steps[i] * b->steps_event_count - (int64_t)b->steps[i] * a->steps_event_count;
+        if(llabs(d) > tolerance) return false;
+    }
+    return true;
+}
+
 void Planner::recalculate()
 {
     Conveyor::Queue_t &queue = THECONVEYOR->queue;
@@ -21,12 +21,17 @@ public:
 
 private:
     bool append_block(ActuatorCoordinates &target, uint8_t n_motors, float rate_mm_s, float distance, float unit_vec[], float accleration, float s_value, bool g123);
+    void append_dwell(float secs);
     void recalculate();
+    bool is_same_direction(const Block *a, const Block *b, uint8_t n_motors) const;
+    float jerk_junction_speed(const Block *prev, const Block *current, float vmax) const;
     void config_load();
     float previous_unit_vec[N_PRIMARY_AXIS];
     float junction_deviation;    // Setting
     float z_junction_deviation;  // Setting
     float minimum_planner_speed; // Setting
+    bool jerk_junction;          // Setting, limit the speed change of each actuator at a junction instead of using junction deviation
+    float slowdown_secs;         // Setting, slow new blocks down when less than this much motion is queued, 0 is disabled
 };
 
 
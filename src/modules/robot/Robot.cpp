@@ -53,6 +53,7 @@
 #define  z_axis_max_speed_checksum           CHECKSUM("z_axis_max_speed")
 #define  segment_z_moves_checksum            CHECKSUM("segment_z_moves")
 #define  save_g92_checksum                   CHECKSUM("save_g92")
+#define  queue_dwell_checksum                CHECKSUM("queue_dwell")
 #define  set_g92_checksum                    CHECKSUM("set_g92")
 
 // arm solutions
@@ -80,6 +81,7 @@
 #define  max_rate_checksum                   CHECKSUM("max_rate")
 #define  acceleration_checksum               CHECKSUM("acceleration")
 #define  z_acceleration_checksum             CHECKSUM("z_acceleration")
+#define  max_jerk_checksum                   CHECKSUM("max_jerk")
 
 #define  alpha_checksum                      CHECKSUM("alpha")
 #define  beta_checksum                       CHECKSUM("beta")
@@ -129,7 +131,8 @@ void Robot::on_module_loaded()
     CHECKSUM(X "_en_pin"),          \
     CHECKSUM(X "_steps_per_mm"),    \
     CHECKSUM(X "_max_rate"),        \
-    CHECKSUM(X "_acceleration")     \
+    CHECKSUM(X "_acceleration"),    \
+    CHECKSUM(X "_max_jerk")         \
 }
 
 void Robot::load_config()
@@ -181,6 +184,7 @@ void Robot::load_config()
 
     this->segment_z_moves     = THEKERNEL->config->value(segment_z_moves_checksum     )->by_default(true)->as_bool();
     this->save_g92            = THEKERNEL->config->value(save_g92_checksum            )->by_default(false)->as_bool();
+    this->queue_dwell         = THEKERNEL->config->value(queue_dwell_checksum         )->by_default(false)->as_bool();
     string g92                = THEKERNEL->config->value(set_g92_checksum             )->by_default("")->as_string();
     if(!g92.empty()) {
         // optional setting for a fixed G92 offset
@@ -194,7 +198,7 @@ void Robot::load_config()
     this->s_value             = THEKERNEL->config->value(laser_module_default_power_checksum)->by_default(0.8F)->as_number();
 
      // Make our Primary XYZ StepperMotors, and potentially A B C
-    uint16_t const checksums[][6] = {
+    uint16_t const checksums[][7] = {
         ACTUATOR_CHECKSUMS("alpha"), // X
         ACTUATOR_CHECKSUMS("beta"),  // Y
         ACTUATOR_CHECKSUMS("gamma"), // Z
@@ -211,6 +215,8 @@ void Robot::load_config()
 
     // default acceleration setting, can be overriden with newer per axis settings
     this->default_acceleration= THEKERNEL->config->value(acceleration_checksum)->by_default(100.0F )->as_number(); // Acceleration is in mm/s^2
+    // default jerk for the jerk junction model, can be overriden per axis
+    float default_jerk= THEKERNEL->config->value(max_jerk_checksum)->by_default(10.0F )->as_number(); // mm/s
 
     // make each motor
     for (size_t a = 0; a < MAX_ROBOT_ACTUATORS; a++) {
@@ -240,6 +246,7 @@ void Robot::load_config()
         actuators[a]->change_steps_per_mm(THEKERNEL->config->value(checksums[a][3])->by_default(a == 2 ? 2560.0F : 80.0F)->as_number());
         actuators[a]->set_max_rate(THEKERNEL->config->value(checksums[a][4])->by_default(30000.0F)->as_number()/60.0F); // it is in mm/min and converted to mm/sec
         actuators[a]->set_acceleration(THEKERNEL->config->value(checksums[a][5])->by_default(NAN)->as_number()); // mm/secs²
+        actuators[a]->set_max_jerk(THEKERNEL->config->value(checksums[a][6])->by_default(default_jerk)->as_number()); // mm/secs
     }
 
     check_max_actuator_speeds(); // check the configs are sane
@@ -331,20 +338,26 @@ void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extrud
     // this does require a FK to get a machine position from the actuator position
     // and then invert all the transforms to get a workspace position from machine position
     // M114 just does it the old way uses machine_position and does inverse transforms to get the requested position
+    // formatting is done without printf as hosts may poll this frequently
     int n = 0;
     char buf[64];
+    float xyz[3];
+    const char *prefix= "";
     if(subcode == 0) { // M114 print WCS
         wcs_t pos= mcs2wcs(machine_position);
-        n = snprintf(buf, sizeof(buf), "C: X:%1.4f Y:%1.4f Z:%1.4f", from_millimeters(std::get<X_AXIS>(pos)), from_millimeters(std::get<Y_AXIS>(pos)), from_millimeters(std::get<Z_AXIS>(pos)));
+        prefix= "C: ";
+        xyz[0]= from_millimeters(std::get<X_AXIS>(pos)); xyz[1]= from_millimeters(std::get<Y_AXIS>(pos)); xyz[2]= from_millimeters(std::get<Z_AXIS>(pos));
 
     } else if(subcode == 4) {
         // M114.4 print last milestone
-        n = snprintf(buf, sizeof(buf), "MP: X:%1.4f Y:%1.4f Z:%1.4f", machine_position[X_AXIS], machine_position[Y_AXIS], machine_position[Z_AXIS]);
+        prefix= "MP: ";
+        memcpy(xyz, machine_position, sizeof(xyz));
 
     } else if(subcode == 5) {
         // M114.5 print last machine position (which should be the same as M114.1 if axis are not moving and no level compensation)
         // will differ from LMS by the compensation at the current position otherwise
-        n = snprintf(buf, sizeof(buf), "CMP: X:%1.4f Y:%1.4f Z:%1.4f", compensated_machine_position[X_AXIS], compensated_machine_position[Y_AXIS], compensated_machine_position[Z_AXIS]);
+        prefix= "CMP: ";
+        memcpy(xyz, compensated_machine_position, sizeof(xyz));
 
     } else {
         // get real time positions
@@ -356,37 +369,50 @@ void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extrud
 
         if(subcode == 1) { // M114.1 print realtime WCS
             wcs_t pos= mcs2wcs(mpos);
-            n = snprintf(buf, sizeof(buf), "WCS: X:%1.4f Y:%1.4f Z:%1.4f", from_millimeters(std::get<X_AXIS>(pos)), from_millimeters(std::get<Y_AXIS>(pos)), from_millimeters(std::get<Z_AXIS>(pos)));
+            prefix= "WCS: ";
+            xyz[0]= from_millimeters(std::get<X_AXIS>(pos)); xyz[1]= from_millimeters(std::get<Y_AXIS>(pos)); xyz[2]= from_millimeters(std::get<Z_AXIS>(pos));
 
         } else if(subcode == 2) { // M114.2 print realtime Machine coordinate system
-            n = snprintf(buf, sizeof(buf), "MCS: X:%1.4f Y:%1.4f Z:%1.4f", mpos[X_AXIS], mpos[Y_AXIS], mpos[Z_AXIS]);
+            prefix= "MCS: ";
+            memcpy(xyz, mpos, sizeof(xyz));
 
         } else if(subcode == 3) { // M114.3 print realtime actuator position
             // get real time current actuator position in mm
-            ActuatorCoordinates current_position{
-                actuators[X_AXIS]->get_current_position(),
-                actuators[Y_AXIS]->get_current_position(),
-                actuators[Z_AXIS]->get_current_position()
-            };
-            n = snprintf(buf, sizeof(buf), "APOS: X:%1.4f Y:%1.4f Z:%1.4f", current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS]);
+            prefix= "APOS: ";
+            xyz[0]= actuators[X_AXIS]->get_current_position();
+            xyz[1]= actuators[Y_AXIS]->get_current_position();
+            xyz[2]= actuators[Z_AXIS]->get_current_position();
+
+        } else {
+            prefix= nullptr;
         }
     }
 
-    res.append(buf, n);
+    if(prefix != nullptr) {
+        n= format_floats(buf, sizeof(buf), xyz, 3, "XYZ");
+        res.append(prefix).append(buf, n);
+    }
 
     #if MAX_ROBOT_ACTUATORS > 3
     // deal with the ABC axis
     for (int i = A_AXIS; i < n_motors; ++i) {
-        n= 0;
         if(ignore_extruders && actuators[i]->is_extruder()) continue; // don't show an extruder as that will be E
+        float v;
         if(subcode == 4) { // M114.4 print last milestone
-            n= snprintf(buf, sizeof(buf), " %c:%1.4f", 'A'+i-A_AXIS, machine_position[i]);
+            v= machine_position[i];
 
         }else if(subcode == 2 || subcode == 3) { // M114.2/M114.3 print actuator position which is the same as machine position for ABC
             // current actuator position
-            n= snprintf(buf, sizeof(buf), " %c:%1.4f", 'A'+i-A_AXIS, actuators[i]->get_current_position());
+            v= actuators[i]->get_current_position();
+
+        }else{
+            continue;
         }
-        if(n > 0) res.append(buf, n);
+        buf[0]= ' ';
+        buf[1]= 'A'+i-A_AXIS;
+        buf[2]= ':';
+        n= 3 + format_float(&buf[3], sizeof(buf) - 3, v);
+        res.append(buf, n);
     }
     #endif
 }
@@ -446,7 +472,12 @@ void Robot::on_gcode_received(void *argument)
                 if (gcode->has_letter('S')) {
                     delay_ms += gcode->get_int('S') * 1000;
                 }
-                if (delay_ms > 0) {
+                if (delay_ms > 0 && queue_dwell) {
+                    // queue a dwell so the wait happens in step with the moves around it without draining the queue,
+                    // only queued commands wait for it, anything else after the G4 runs straight away
+                    THEKERNEL->planner->append_dwell(delay_ms / 1000.0F);
+
+                } else if (delay_ms > 0) {
                     // drain queue
                     THEKERNEL->conveyor->wait_for_idle();
                     // wait for specified time
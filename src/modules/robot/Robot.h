@@ -42,6 +42,7 @@ class Robot : public Module {
         float get_default_acceleration() const { return default_acceleration; }
         void setToolOffset(const float offset[N_PRIMARY_AXIS]);
         float get_feed_rate() const;
+        int get_active_extruder() const;
         float get_s_value() const { return s_value; }
         void set_s_value(float s) { s_value= s; }
         void  push_state();
@@ -85,6 +86,7 @@ class Robot : public Module {
             bool disable_arm_solution:1;                      // set to disable the arm solution
             bool segment_z_moves:1;
             bool save_g92:1;                                  // save g92 on M500 if set
+            bool queue_dwell:1;                               // G4 queues a dwell block instead of draining the queue and waiting
             bool is_g123:1;
             uint8_t plane_axis_0:2;                           // Current plane ( XY, XZ, YZ )
             uint8_t plane_axis_1:2;
@@ -110,7 +112,6 @@ class Robot : public Module {
         float theta(float x, float y);
         void select_plane(uint8_t axis_0, uint8_t axis_1, uint8_t axis_2);
         void clearToolOffset();
-        int get_active_extruder() const;
 
         std::array<wcs_t, MAX_WCS> wcs_offsets; // these are persistent once saved with M500
         uint8_t current_wcs{0}; // 0 means G54 is enabled this is persistent once saved with M500
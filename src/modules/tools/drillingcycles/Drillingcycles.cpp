@@ -50,7 +50,7 @@ void Drillingcycles::on_module_loaded()
     this->on_config_reload(this);
 
     // events
-    this->register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t g : {80, 81, 82, 83, 98, 99}) this->register_for_gcode('G', g);
 
     // reset values
     this->cycle_started = false;
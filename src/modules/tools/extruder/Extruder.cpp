@@ -79,7 +79,9 @@ void Extruder::on_module_loaded()
     this->config_load();
 
     // We work on the same Block as Stepper, so we need to know when it gets a new one and drops one
-    this->register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {92, 114, 200, 203, 204, 207, 208, 221, 500, 503}) this->register_for_gcode('M', m);
+    // G0/G1 are needed to notice a Z move while retracted
+    for(uint16_t g : {0, 1, 10, 11, 92}) this->register_for_gcode('G', g);
     this->register_for_event(ON_GET_PUBLIC_DATA);
     this->register_for_event(ON_SET_PUBLIC_DATA);
 }
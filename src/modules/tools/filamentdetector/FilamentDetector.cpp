@@ -96,7 +96,7 @@ void FilamentDetector::on_module_loaded()
 
     register_for_event(ON_MAIN_LOOP);
     register_for_event(ON_CONSOLE_LINE_RECEIVED);
-    this->register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {404, 405, 406, 407}) this->register_for_gcode('M', m);
 }
 
 
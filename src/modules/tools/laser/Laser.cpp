@@ -108,7 +108,7 @@ void Laser::on_module_loaded()
 
     //register for events
     this->register_for_event(ON_HALT);
-    this->register_for_event(ON_GCODE_RECEIVED);
+    this->register_for_gcode('M', 221);
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
     this->register_for_event(ON_GET_PUBLIC_DATA);
 
@@ -47,7 +47,7 @@ void SCARAcal::on_module_loaded()
     // load settings
     this->on_config_reload(this);
     // register event-handlers
-    register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {114, 360, 361, 362, 363, 364, 366}) register_for_gcode('M', m);
 }
 
 void SCARAcal::on_config_reload(void *argument)
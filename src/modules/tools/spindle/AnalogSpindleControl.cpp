@@ -60,7 +60,7 @@ void AnalogSpindleControl::on_module_loaded()
         switch_on->from_string(switch_on_pin)->as_output()->set(false);
     }
     // register for events
-    register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {3, 5, 957, 958}) register_for_gcode('M', m);
 }
 
 void AnalogSpindleControl::turn_on() 
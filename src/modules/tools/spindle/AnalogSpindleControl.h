@@ -34,6 +34,7 @@ class AnalogSpindleControl: public SpindleControl {
         int min_rpm;
         int max_rpm;
 
+        bool can_queue() const { return true; };
         void turn_on(void);
         void turn_off(void);
         void set_speed(int);
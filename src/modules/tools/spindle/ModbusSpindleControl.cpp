@@ -50,6 +50,6 @@ void ModbusSpindleControl::on_module_loaded()
     modbus = new Modbus(tx_pin, rx_pin, dir_pin);
 
     // register for events
-    register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {3, 5, 957, 958}) register_for_gcode('M', m);
 }
 
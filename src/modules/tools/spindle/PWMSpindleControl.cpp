@@ -105,7 +105,7 @@ void PWMSpindleControl::on_module_loaded()
     
     THEKERNEL->slow_ticker->attach(UPDATE_FREQ, this, &PWMSpindleControl::on_update_speed);
 
-    register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {3, 5, 957, 958}) register_for_gcode('M', m);
 }
 
 void PWMSpindleControl::on_pin_rise()
@@ -56,6 +56,7 @@ class PWMSpindleControl: public SpindleControl {
         volatile uint32_t last_time; // Time delay between last two edges
         volatile uint32_t irq_count;
         
+        bool can_queue() const { return true; };
         void turn_on(void);
         void turn_off(void);
         void set_speed(int);
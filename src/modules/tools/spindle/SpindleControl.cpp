@@ -11,6 +11,8 @@
 #include "Conveyor.h"
 #include "SpindleControl.h"
 
+#include <math.h>
+
 void SpindleControl::on_gcode_received(void *argument) 
 {
     
@@ -39,27 +41,46 @@ void SpindleControl::on_gcode_received(void *argument)
         }
         else if (gcode->m == 3) 
         {
-            THECONVEYOR->wait_for_idle();
-            // M3: Spindle on
-            if(!spindle_on) {
-                turn_on();
-            }
-            
-            // M3 with S value provided: set speed
-            if (gcode->has_letter('S'))
-            {
-                set_speed(gcode->get_value('S'));
+            // M3: Spindle on, M3 with S value provided: set speed
+            float speed= gcode->has_letter('S') ? gcode->get_value('S') : NAN;
+            if(can_queue()) {
+                THECONVEYOR->queue_action(&SpindleControl::spindle_action, this, speed);
+            } else {
+                THECONVEYOR->wait_for_idle();
+                spindle_action(this, speed);
             }
         }
         else if (gcode->m == 5)
         {
-            THECONVEYOR->wait_for_idle();
             // M5: spindle off
-            if(spindle_on) {
-                turn_off();
+            if(can_queue()) {
+                THECONVEYOR->queue_action(&SpindleControl::spindle_action, this, -1);
+            } else {
+                THECONVEYOR->wait_for_idle();
+                spindle_action(this, -1);
             }
         }
     }
 
 }
 
+// turns the spindle on and sets the speed if it is not NAN, a negative speed turns it off.
+// called from the step ticker ISR when the spindle can_queue()
+void SpindleControl::spindle_action(void *obj, float speed)
+{
+    SpindleControl *s= static_cast<SpindleControl *>(obj);
+    if(speed < 0) {
+        if(s->spindle_on) {
+            s->turn_off();
+        }
+        return;
+    }
+
+    if(!s->spindle_on) {
+        s->turn_on();
+    }
+
+    if(!isnan(speed)) {
+        s->set_speed(speed);
+    }
+}
@@ -21,7 +21,10 @@ class SpindleControl: public Module {
 
     private:
         void on_gcode_received(void *argument);
-        
+        static void spindle_action(void *obj, float speed);
+
+        // true if the spindle can be switched from the step ticker ISR, so M3/M5 can be queued with the moves
+        virtual bool can_queue() const { return false; };
         virtual void turn_on(void) {};
         virtual void turn_off(void) {};
         virtual void set_speed(int) {};
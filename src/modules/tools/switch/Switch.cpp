@@ -51,6 +51,7 @@ Switch::Switch() {}
 Switch::Switch(uint16_t name)
 {
     this->name_checksum = name;
+    this->queued_value = NAN;
     //this->dummy_stream = &(StreamOutput::NullStream);
 }
 
@@ -68,6 +69,7 @@ void Switch::on_halt(void *arg)
             case NONE: break;
         }
         this->switch_state= this->failsafe;
+        this->queued_value= NAN;
     }
 }
 
@@ -75,7 +77,6 @@ void Switch::on_module_loaded()
 {
     this->switch_changed = false;
 
-    this->register_for_event(ON_GCODE_RECEIVED);
     this->register_for_event(ON_MAIN_LOOP);
     this->register_for_event(ON_GET_PUBLIC_DATA);
     this->register_for_event(ON_SET_PUBLIC_DATA);
@@ -179,6 +180,7 @@ void Switch::on_config_reload(void *argument)
     } else if(this->output_type == DIGITAL){
         this->digital_pin->set(this->switch_state);
     }
+    this->queued_value= NAN;
 
     // Set the on/off command codes, Use GCode to do the parsing
     input_on_command_letter = 0;
@@ -205,6 +207,11 @@ void Switch::on_config_reload(void *argument)
         }
     }
 
+    // we only need to see our on and off commands, the ones from before a reload are dropped first
+    THEKERNEL->unregister_for_event(ON_GCODE_RECEIVED, this);
+    if(input_on_command_letter != 0) this->register_for_gcode(input_on_command_letter, input_on_command_code);
+    if(input_off_command_letter != 0) this->register_for_gcode(input_off_command_letter, input_off_command_code);
+
     if(input_pin.connected()) {
         // set to initial state
         this->input_pin_state = this->input_pin.get();
@@ -245,65 +252,66 @@ void Switch::on_gcode_received(void *argument)
         return;
     }
 
-    // we need to sync this with the queue, so we need to wait for queue to empty, however due to certain slicers
-    // issuing redundant swicth on calls regularly we need to optimize by making sure the value is actually changing
-    // hence we need to do the wait for queue in each case rather than just once at the start
+    // the output is changed in sync with the queue, when the moves queued before this gcode have finished,
+    // switch_state is what it will be once they have
+    float value;
     if(match_input_on_gcode(gcode)) {
         if (this->output_type == SIGMADELTA) {
             // SIGMADELTA output pin turn on (or off if S0)
             if(gcode->has_letter('S')) {
-                int v = roundf(gcode->get_value('S') * sigmadelta_pin->max_pwm() / 255.0F); // scale by max_pwm so input of 255 and max_pwm of 128 would set value to 128
-                if(v != this->sigmadelta_pin->get_pwm()){ // optimize... ignore if already set to the same pwm
-                    // drain queue
-                    THEKERNEL->conveyor->wait_for_idle();
-                    this->sigmadelta_pin->pwm(v);
-                    this->switch_state= (v > 0);
-                }
+                value = roundf(gcode->get_value('S') * sigmadelta_pin->max_pwm() / 255.0F); // scale by max_pwm so input of 255 and max_pwm of 128 would set value to 128
             } else {
-                // drain queue
-                THEKERNEL->conveyor->wait_for_idle();
-                this->sigmadelta_pin->pwm(this->switch_value);
-                this->switch_state= (this->switch_value > 0);
+                value = this->switch_value;
             }
+            this->switch_state= (value > 0);
 
         } else if (this->output_type == HWPWM) {
-            // drain queue
-            THEKERNEL->conveyor->wait_for_idle();
             // PWM output pin set duty cycle 0 - 100
             if(gcode->has_letter('S')) {
                 float v = gcode->get_value('S');
                 if(v > 100) v= 100;
                 else if(v < 0) v= 0;
-                this->pwm_pin->write(v/100.0F);
-                this->switch_state= (v != 0);
+                value = v/100.0F;
             } else {
-                this->pwm_pin->write(this->switch_value);
-                this->switch_state= (this->switch_value != 0);
+                value = this->switch_value;
             }
+            this->switch_state= (value != 0);
 
         } else if (this->output_type == DIGITAL) {
-            // drain queue
-            THEKERNEL->conveyor->wait_for_idle();
             // logic pin turn on
-            this->digital_pin->set(true);
+            value = 1;
             this->switch_state = true;
+
+        } else {
+            return;
         }
 
-    } else if(match_input_off_gcode(gcode)) {
-        // drain queue
-        THEKERNEL->conveyor->wait_for_idle();
+    } else {
+        // turn off
+        value = -1;
         this->switch_state = false;
-        if (this->output_type == SIGMADELTA) {
-            // SIGMADELTA output pin
-            this->sigmadelta_pin->set(false);
+    }
 
-        } else if (this->output_type == HWPWM) {
-            this->pwm_pin->write(0);
+    // slicers repeat the same fan speed on many lines, do not use up an action slot when it is not changing
+    if(value == this->queued_value) return;
+    this->queued_value= value;
 
-        } else if (this->output_type == DIGITAL) {
-            // logic pin turn off
-            this->digital_pin->set(false);
-        }
+    THEKERNEL->conveyor->queue_action(&Switch::set_output, this, value);
+}
+
+// called from the step ticker ISR when queued, a negative value turns the output off
+void Switch::set_output(void *sw, float value)
+{
+    Switch *s= static_cast<Switch *>(sw);
+    if (s->output_type == SIGMADELTA) {
+        if(value < 0) s->sigmadelta_pin->set(false);
+        else s->sigmadelta_pin->pwm(value);
+
+    } else if (s->output_type == HWPWM) {
+        s->pwm_pin->write(value < 0 ? 0 : value);
+
+    } else if (s->output_type == DIGITAL) {
+        s->digital_pin->set(value > 0);
     }
 }
 
@@ -382,6 +390,7 @@ void Switch::on_main_loop(void *argument)
             }
         }
         this->switch_changed = false;
+        this->queued_value= NAN;
     }
 }
 
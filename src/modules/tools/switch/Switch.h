@@ -39,12 +39,14 @@ class Switch : public Module {
 
     private:
         void flip();
+        static void set_output(void *sw, float value);
         void send_gcode(std::string msg, StreamOutput* stream);
         bool match_input_on_gcode(const Gcode* gcode) const;
         bool match_input_off_gcode(const Gcode* gcode) const;
 
         Pin       input_pin;
         float     switch_value;
+        float     queued_value; // the value last queued by a gcode, NAN once the output was set some other way
         OUTPUT_TYPE output_type;
         union {
             Pin          *digital_pin;
@@ -95,10 +95,14 @@ void TemperatureControl::on_module_loaded()
     this->load_config();
 
     // Register for events
-    this->register_for_event(ON_GCODE_RECEIVED);
+    this->register_for_gcode('M', this->get_m_code);
+    this->register_for_gcode('M', 305);
     this->register_for_event(ON_GET_PUBLIC_DATA);
 
     if(!this->readonly) {
+        for(uint16_t m : {143, 301, 500, 503}) this->register_for_gcode('M', m);
+        this->register_for_gcode('M', this->set_m_code);
+        this->register_for_gcode('M', this->set_and_wait_m_code);
         this->register_for_event(ON_SECOND_TICK);
         this->register_for_event(ON_MAIN_LOOP);
         this->register_for_event(ON_SET_PUBLIC_DATA);
@@ -231,8 +235,13 @@ void TemperatureControl::on_gcode_received(void *argument)
     if (gcode->has_m) {
 
         if( gcode->m == this->get_m_code ) {
+            // hosts poll this continuously so the floats are formatted without printf
             char buf[32]; // should be big enough for any status
-            int n = snprintf(buf, sizeof(buf), "%s:%3.1f /%3.1f @%d ", this->designator.c_str(), this->get_temperature(), ((target_temperature <= 0) ? 0.0 : target_temperature), this->o);
+            int n = format_float(buf, sizeof(buf), this->get_temperature(), 1);
+            gcode->txt_after_ok.append(this->designator).append(":").append(buf, n);
+            n = format_float(buf, sizeof(buf), ((target_temperature <= 0) ? 0.0F : target_temperature), 1);
+            gcode->txt_after_ok.append(" /").append(buf, n);
+            n = snprintf(buf, sizeof(buf), " @%d ", this->o);
             gcode->txt_after_ok.append(buf, n);
             return;
         }
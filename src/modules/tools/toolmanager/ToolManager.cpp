@@ -54,8 +54,7 @@ void ToolManager::on_gcode_received(void *argument)
 
         } else {
             if(new_tool != this->active_tool) {
-                // We must wait for an empty queue before we can disable the current extruder
-                THEKERNEL->conveyor->wait_for_idle();
+                // the following moves are planned for the new tool and its offsets right away, the queue keeps running
                 this->tools[active_tool]->deselect();
                 this->active_tool = new_tool;
                 this->current_tool_name = this->tools[active_tool]->get_name();
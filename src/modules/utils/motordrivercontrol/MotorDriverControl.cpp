@@ -178,7 +178,7 @@ bool MotorDriverControl::config_module(uint16_t cs)
         rawreg= false;
     }
 
-    this->register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {906, 909, 910, 911, 500, 503}) this->register_for_gcode('M', m);
     this->register_for_event(ON_HALT);
     this->register_for_event(ON_ENABLE);
     this->register_for_event(ON_IDLE);
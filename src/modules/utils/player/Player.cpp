@@ -28,6 +28,8 @@
 #include "PlayerPublicAccess.h"
 #include "TemperatureControlPublicAccess.h"
 #include "TemperatureControlPool.h"
+#include "GcodeDispatch.h"
+#include "platform_memory.h"
 #include "ExtruderPublicAccess.h"
 
 #include <cstddef>
@@ -41,18 +43,71 @@
 #define after_suspend_gcode_checksum      CHECKSUM("after_suspend_gcode")
 #define before_resume_gcode_checksum      CHECKSUM("before_resume_gcode")
 #define leave_heaters_on_suspend_checksum CHECKSUM("leave_heaters_on_suspend")
+#define journal_enable_checksum           CHECKSUM("journal_enable")
+#define journal_interval_checksum         CHECKSUM("journal_interval")
+
+// the file is read in sector multiples, and lines are fed until the queue is full or this long has passed
+#define PLAYER_READ_SIZE 2048
+#define PLAYER_BATCH_US 10000
+// a job tokenized offline by gcode-pack.py starts with this instead of text
+#define PLAYER_BINARY_MAGIC "SBG1"
+
+// the index of a file is kept next to it in <filename>.idx, it has an entry at the start of each layer and every PLAYER_INDEX_LINES lines
+#define PLAYER_INDEX_MAGIC "SPX2"
+#define PLAYER_INDEX_LINES 1000
+// extruding this much above the last layer starts a new one, so Z hops and the slow rise of vase mode are not each a layer
+#define PLAYER_MIN_LAYER 0.05F
+// how far to lift Z above the restart point while moving to it
+#define PLAYER_RESTART_LIFT 5.0F
+
+#define PLAYER_STATE_RELATIVE   0x01 // G91
+#define PLAYER_STATE_RELATIVE_E 0x02 // M83
+#define PLAYER_STATE_INCHES     0x04 // G20
+#define PLAYER_STATE_BINARY     0x08 // tokenized file
+
+// the journal has two sector sized records that are written in turn in place, so a write never changes the FAT or the directory,
+// the valid one with the highest sequence number is the latest
+#define PLAYER_JOURNAL_FILE "/sd/player.jnl"
+#define PLAYER_JOURNAL_MAGIC "SPJ1"
+#define PLAYER_JOURNAL_SLOTS 2
+#define PLAYER_JOURNAL_HEATERS 4
 
 extern SDFAT mounter;
 
+struct Player::journal_record_t {
+    char magic[4];
+    uint32_t seq;
+    uint32_t offset;                    // where to carry on playing
+    uint32_t file_size;
+    float pos[3];                       // XYZ in machine coordinates
+    float e;
+    float feed_rate;                    // mm/min
+    uint16_t heater_id[PLAYER_JOURNAL_HEATERS];
+    float heater_temp[PLAYER_JOURNAL_HEATERS];
+    uint8_t n_heaters;
+    uint8_t flags;                      // see PLAYER_STATE_*
+    char filename[128];                 // empty when there is nothing to recover
+    uint32_t checksum;
+};
+
 Player::Player()
 {
     this->playing_file = false;
     this->current_file_handler = nullptr;
+    this->read_buf = nullptr;
+    this->read_pos = this->read_len = 0;
     this->booted = false;
     this->elapsed_secs = 0;
     this->reply_stream = nullptr;
     this->suspended= false;
     this->suspend_loops= 0;
+    this->journal_fd = nullptr;
+    this->journal_rec = nullptr;
+    this->journal_seq = 0;
+    this->journal_secs = 0;
+    this->journal_ready = false;
+    this->journal_pending = false;
+    this->journal_done = false;
 }
 
 void Player::on_module_loaded()
@@ -62,7 +117,8 @@ void Player::on_module_loaded()
     this->register_for_event(ON_SECOND_TICK);
     this->register_for_event(ON_GET_PUBLIC_DATA);
     this->register_for_event(ON_SET_PUBLIC_DATA);
-    this->register_for_event(ON_GCODE_RECEIVED);
+    for(uint16_t m : {21, 23, 24, 25, 26, 27, 32, 600, 601}) this->register_for_gcode('M', m);
+    this->register_for_gcode('G', 28); // homing cancels suspend
     this->register_for_event(ON_HALT);
 
     this->on_boot_gcode = THEKERNEL->config->value(on_boot_gcode_checksum)->by_default("/sd/on_boot.gcode")->as_string();
@@ -73,6 +129,11 @@ void Player::on_module_loaded()
     std::replace( this->after_suspend_gcode.begin(), this->after_suspend_gcode.end(), '_', ' '); // replace _ with space
     std::replace( this->before_resume_gcode.begin(), this->before_resume_gcode.end(), '_', ' '); // replace _ with space
     this->leave_heaters_on = THEKERNEL->config->value(leave_heaters_on_suspend_checksum)->by_default(false)->as_bool();
+
+    // periodically record where a job is so it can be recovered after a power loss
+    this->journal_enable = THEKERNEL->config->value(journal_enable_checksum)->by_default(false)->as_bool();
+    this->journal_interval = THEKERNEL->config->value(journal_interval_checksum)->by_default(10)->as_int();
+    if(this->journal_interval < 1) this->journal_interval = 1;
 }
 
 void Player::on_halt(void* argument)
@@ -84,7 +145,10 @@ void Player::on_halt(void* argument)
 
 void Player::on_second_tick(void *)
 {
-    if(this->playing_file) this->elapsed_secs++;
+    if(this->playing_file) {
+        this->elapsed_secs++;
+        if(this->journal_secs < 0xFFFF) this->journal_secs++;
+    }
 }
 
 // extract any options found on line, terminates args at the space before the first option (-v)
@@ -140,6 +204,7 @@ void Player::on_gcode_received(void *argument)
 
 
             this->played_cnt = 0;
+            this->read_pos = this->read_len = 0;
             this->elapsed_secs = 0;
 
         } else if (gcode->m == 24) { // start print
@@ -208,6 +273,7 @@ void Player::on_gcode_received(void *argument)
             }
 
             this->played_cnt = 0;
+            this->read_pos = this->read_len = 0;
             this->elapsed_secs = 0;
 
         } else if (gcode->m == 600) { // suspend print, Not entirely Marlin compliant, M600.1 will leave the heaters on
@@ -260,6 +326,8 @@ void Player::on_console_line_received( void *argument )
         this->suspend_command( possible_command, new_message.stream );
     }else if (cmd == "resume") {
         this->resume_command( possible_command, new_message.stream );
+    }else if (cmd == "recover") {
+        this->recover_command( possible_command, new_message.stream );
     }
 }
 
@@ -309,7 +377,320 @@ void Player::play_command( string parameters, StreamOutput *stream )
         stream->printf("  File size %ld\r\n", file_size);
     }
     this->played_cnt = 0;
+    this->read_pos = this->read_len = 0;
     this->elapsed_secs = 0;
+
+    // -l<line> or -z<height> starts part way through the file
+    if(options.find(" -l") != string::npos || options.find(" -z") != string::npos) {
+        play_state_t state;
+        this->playing_file = false;
+        if(!find_start(options, state, stream)) {
+            fclose(this->current_file_handler);
+            this->current_file_handler = NULL;
+            this->current_stream = NULL;
+            return;
+        }
+
+        StreamOutput *s = this->current_stream;
+        this->current_stream = nullptr;
+        start_from(state, stream);
+        this->current_stream = s;
+        this->playing_file = !THEKERNEL->is_halted();
+    }
+}
+
+// update the modal state with one line of the file, only what is needed to restart at a later line is tracked
+// returns true if the line is a move that extrudes
+bool Player::track_line(play_state_t& state, const char *line, size_t len)
+{
+    // comments are not part of the command
+    for (size_t i = 0; i < len; ++i) {
+        if(line[i] == ';' || line[i] == '(') {
+            len = i;
+            break;
+        }
+    }
+
+    Gcode gcode(line, len, &(StreamOutput::NullStream));
+
+    // a line of just coordinates is a move with the last G0 to G3, the same test as in GcodeDispatch
+    int g = gcode.has_g ? (int)gcode.g : -1;
+    if(g < 0 && len > 0 && strchr("GMTSN", line[0]) == nullptr) {
+        const char *n = std::find_first_of(line, line + len, "XYZF", "XYZF" + 4);
+        if(n == line || (line[0] == ' ' && n != line + len)) g = state.modal_g;
+    }
+
+    bool extrudes = false;
+    if(g >= 0) {
+        switch(g) {
+            case 0: case 1: case 2: case 3: {
+                state.modal_g = g;
+                bool xy = false;
+                for (int i = 0; i < 3; ++i) {
+                    char letter = 'X' + i;
+                    if(!gcode.has_letter(letter)) continue;
+                    float v = gcode.get_value(letter);
+                    float old = state.pos[i];
+                    state.pos[i] = (state.flags & PLAYER_STATE_RELATIVE) ? state.pos[i] + v : v;
+                    if(i < 2 && state.pos[i] != old) xy = true;
+                }
+                if(gcode.has_letter('E')) {
+                    float v = gcode.get_value('E');
+                    float old = state.e;
+                    state.e = (state.flags & (PLAYER_STATE_RELATIVE | PLAYER_STATE_RELATIVE_E)) ? state.e + v : v;
+                    extrudes = xy && state.e > old;
+                }
+                if(g != 0 && gcode.has_letter('F')) state.feed_rate = gcode.get_value('F');
+                break;
+            }
+            case 20: state.flags |= PLAYER_STATE_INCHES; break;
+            case 21: state.flags &= ~PLAYER_STATE_INCHES; break;
+            case 90: state.flags &= ~PLAYER_STATE_RELATIVE; break;
+            case 91: state.flags |= PLAYER_STATE_RELATIVE; break;
+            case 92:
+                for (int i = 0; i < 3; ++i) {
+                    if(gcode.has_letter('X' + i)) state.pos[i] = gcode.get_value('X' + i);
+                }
+                if(gcode.has_letter('E')) state.e = gcode.get_value('E');
+                break;
+        }
+
+    } else if(gcode.has_m) {
+        switch(gcode.m) {
+            case 82: state.flags &= ~PLAYER_STATE_RELATIVE_E; break;
+            case 83: state.flags |= PLAYER_STATE_RELATIVE_E; break;
+            case 104: case 109:
+                // only the first hotend is restored
+                if(gcode.has_letter('S') && (!gcode.has_letter('T') || gcode.get_int('T') == 0)) state.hotend_temp = gcode.get_value('S');
+                break;
+            case 140: case 190:
+                if(gcode.has_letter('S')) state.bed_temp = gcode.get_value('S');
+                break;
+        }
+    }
+
+    return extrudes;
+}
+
+// scan the whole file and save an index of it, leaves the file at its start
+bool Player::build_index(const string& index_name, StreamOutput* stream)
+{
+    FILE *fd = fopen(index_name.c_str(), "w");
+    if(fd == NULL) {
+        stream->printf("Could not create %s\r\n", index_name.c_str());
+        return false;
+    }
+
+    stream->printf("Indexing %s...\r\n", this->filename.c_str());
+
+    uint32_t size = this->file_size;
+    uint32_t count = 0;
+    fwrite(PLAYER_INDEX_MAGIC, 1, 4, fd);
+    fwrite(&size, sizeof(size), 1, fd);
+    fwrite(&count, sizeof(count), 1, fd); // filled in at the end
+
+    fseek(this->current_file_handler, 0, SEEK_SET);
+    played_cnt = 0;
+    read_pos = read_len = 0;
+
+    play_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.line = 1;
+    state.layer_z = NAN;
+    uint32_t last_line = 0;
+
+    // a layer starts where Z went up to the height of the next extruding move, until that move is found
+    // the line where Z went up is kept as a candidate, a Z hop comes back down before extruding so is dropped
+    float printed_z = NAN;
+    play_state_t candidate;
+    bool pending = false;
+
+    char buf[130];
+    bool too_long;
+    size_t len;
+    while(true) {
+        uint32_t offset = played_cnt;
+        if((len = read_line(buf, sizeof(buf), too_long)) == 0) break;
+
+        play_state_t before = state;
+        before.offset = offset;
+        bool extrudes = !too_long && track_line(state, buf, len);
+
+        if(!pending && state.pos[2] > before.pos[2]) {
+            candidate = before;
+            pending = true;
+        }
+
+        // entries hold the state before their line, the first one is the start of the file
+        bool layer = false;
+        if(extrudes) {
+            if(isnan(printed_z) || state.pos[2] >= printed_z + PLAYER_MIN_LAYER) {
+                // Z went up on this line or at the candidate and stayed there
+                if(!pending) candidate = before;
+                candidate.layer_z = state.pos[2];
+                layer = true;
+                printed_z = state.pos[2];
+
+            } else if(state.pos[2] < printed_z) {
+                // back down, eg the next object of a sequential print
+                printed_z = state.pos[2];
+            }
+            pending = false;
+
+        } else if(pending && before.line - candidate.line >= PLAYER_INDEX_LINES) {
+            // no extruding move followed so it was not a layer
+            pending = false;
+        }
+
+        if(layer) {
+            fwrite(&candidate, sizeof(candidate), 1, fd);
+            last_line = candidate.line;
+            count++;
+
+        } else if(count == 0 || (!pending && before.line - last_line >= PLAYER_INDEX_LINES)) {
+            // none while a candidate is pending so the entries stay in line order
+            before.layer_z = NAN;
+            fwrite(&before, sizeof(before), 1, fd);
+            last_line = before.line;
+            count++;
+        }
+
+        state.line++;
+        if((state.line & 0x3FFF) == 0) THEKERNEL->call_event(ON_IDLE, this);
+    }
+
+    fseek(fd, 8, SEEK_SET);
+    fwrite(&count, sizeof(count), 1, fd);
+    fclose(fd);
+
+    fseek(this->current_file_handler, 0, SEEK_SET);
+    played_cnt = 0;
+    read_pos = read_len = 0;
+
+    stream->printf("  %lu lines, %lu index entries\r\n", state.line - 1, count);
+    return true;
+}
+
+// find where to start from the -l<line> or -z<height> option and the state there, using the index of the file
+bool Player::find_start(const string& options, play_state_t& state, StreamOutput* stream)
+{
+    size_t p = options.find(" -l");
+    bool by_line = p != string::npos;
+    if(!by_line) p = options.find(" -z");
+    float target = strtof(options.c_str() + p + 3, nullptr);
+    if(by_line && target < 1) target = 1;
+
+    char magic[4];
+    if(fread(magic, 1, 4, this->current_file_handler) == 4 && memcmp(magic, PLAYER_BINARY_MAGIC, 4) == 0) {
+        stream->printf("Can not start a tokenized file part way through, play the gcode file instead\r\n");
+        return false;
+    }
+    fseek(this->current_file_handler, 0, SEEK_SET);
+
+    // the index is rebuilt if the file changed since it was made
+    string index_name = this->filename + ".idx";
+    FILE *fd = fopen(index_name.c_str(), "r");
+    uint32_t size = 0, count = 0;
+    if(fd != NULL && (fread(magic, 1, 4, fd) != 4 || memcmp(magic, PLAYER_INDEX_MAGIC, 4) != 0 ||
+                      fread(&size, sizeof(size), 1, fd) != 1 || size != (uint32_t)this->file_size || fread(&count, sizeof(count), 1, fd) != 1 || count == 0)) {
+        fclose(fd);
+        fd = NULL;
+    }
+    if(fd == NULL) {
+        if(!build_index(index_name, stream)) return false;
+        fd = fopen(index_name.c_str(), "r");
+        if(fd == NULL) return false;
+        fseek(fd, 12, SEEK_SET);
+    }
+
+    // the last entry at or before the line, or the first layer at or above the height
+    bool found = false;
+    play_state_t e;
+    while(fread(&e, sizeof(e), 1, fd) == 1) {
+        if(by_line) {
+            if(e.line > target) break;
+            state = e;
+            found = true;
+        } else if(!isnan(e.layer_z) && e.layer_z >= target - 0.0001F) {
+            state = e;
+            found = true;
+            break;
+        }
+    }
+    fclose(fd);
+
+    if(!found) {
+        stream->printf("%s not found in %s\r\n", by_line ? "Line" : "Layer", this->filename.c_str());
+        return false;
+    }
+
+    // go forward to the line itself
+    fseek(this->current_file_handler, state.offset, SEEK_SET);
+    played_cnt = state.offset;
+    read_pos = read_len = 0;
+    if(by_line) {
+        char buf[130];
+        bool too_long;
+        size_t len;
+        while(state.line < target) {
+            if((len = read_line(buf, sizeof(buf), too_long)) == 0) {
+                stream->printf("Line not found in %s\r\n", this->filename.c_str());
+                return false;
+            }
+            if(!too_long) track_line(state, buf, len);
+            state.line++;
+        }
+        state.offset = played_cnt;
+    }
+
+    stream->printf("Starting at line %lu byte %lu\r\n", state.line, state.offset);
+    return true;
+}
+
+// set the machine up as it would be at the start of the line and carry on playing from there
+void Player::start_from(const play_state_t& state, StreamOutput* stream)
+{
+    char buf[128];
+
+    dispatch_line((state.flags & PLAYER_STATE_INCHES) ? "G20" : "G21");
+    dispatch_line((state.flags & PLAYER_STATE_RELATIVE_E) ? "M83" : "M82");
+
+    // heat up first, the M109 and M190 wait for the temperature
+    if(state.bed_temp > 0) {
+        snprintf(buf, sizeof(buf), "M190 S%1.1f", state.bed_temp);
+        stream->printf("Waiting for bed to reach %1.1f...\r\n", state.bed_temp);
+        dispatch_line(buf);
+    }
+    if(state.hotend_temp > 0) {
+        snprintf(buf, sizeof(buf), "M109 S%1.1f", state.hotend_temp);
+        stream->printf("Waiting for hotend to reach %1.1f...\r\n", state.hotend_temp);
+        dispatch_line(buf);
+    }
+    if(THEKERNEL->is_halted()) return;
+
+    // approach from above so the part is not hit on the way
+    dispatch_line("G90");
+    snprintf(buf, sizeof(buf), "G0 Z%1.4f", state.pos[2] + PLAYER_RESTART_LIFT);
+    dispatch_line(buf);
+    snprintf(buf, sizeof(buf), "G0 X%1.4f Y%1.4f", state.pos[0], state.pos[1]);
+    dispatch_line(buf);
+    snprintf(buf, sizeof(buf), "G0 Z%1.4f", state.pos[2]);
+    dispatch_line(buf);
+
+    snprintf(buf, sizeof(buf), "G92 E%1.5f", state.e);
+    dispatch_line(buf);
+    if(state.feed_rate > 0) {
+        snprintf(buf, sizeof(buf), "G1 F%1.4f", state.feed_rate);
+        dispatch_line(buf);
+    }
+    // the modal move for lines that are just coordinates
+    if(state.modal_g == 0) dispatch_line("G0");
+    if(state.flags & PLAYER_STATE_RELATIVE) dispatch_line("G91");
+
+    fseek(this->current_file_handler, state.offset, SEEK_SET);
+    played_cnt = state.offset;
+    read_pos = read_len = 0;
+    this->binary_file = false;
 }
 
 void Player::progress_command( string parameters, StreamOutput *stream )
@@ -365,7 +746,15 @@ void Player::abort_command( string parameters, StreamOutput *stream )
     suspended= false;
     playing_file = false;
     played_cnt = 0;
+    read_pos = read_len = 0;
     file_size = 0;
+    if(parameters.empty()) {
+        // an aborted job is not recovered, even if it was aborted before its first snapshot and the record is an older job's
+        journal_clear();
+    } else if(journal_fd != nullptr) {
+        // on halt (kill button, thermal fault...) the last record written is kept, so the job can still be recovered
+        journal_close();
+    }
     this->filename = "";
     this->current_stream = NULL;
     fclose(current_file_handler);
@@ -391,8 +780,25 @@ void Player::on_main_loop(void *argument)
         }
     }
 
+    if(this->journal_ready) {
+        // the motion has caught up with the last snapshot
+        this->journal_ready = false;
+        this->journal_pending = false;
+        if(this->journal_fd != nullptr) {
+            journal_write();
+            if(this->journal_rec->filename[0] == '\0') journal_close();
+            else if(this->journal_done) journal_snapshot(true);
+        }
+    }
+
     if( !this->booted ) {
         this->booted = true;
+        if(this->journal_enable) {
+            journal_record_t rec;
+            if(journal_read(rec) && rec.filename[0] != '\0') {
+                THEKERNEL->streams->printf("// %s was interrupted at byte %lu of %lu, enter recover to continue it\r\n", rec.filename, rec.offset, rec.file_size);
+            }
+        }
         if( this->on_boot_gcode_enable ) {
             this->play_command(this->on_boot_gcode, THEKERNEL->serial);
         } else {
@@ -405,42 +811,48 @@ void Player::on_main_loop(void *argument)
             return;
         }
 
-        char buf[130]; // lines upto 128 characters are allowed, anything longer is discarded
-        bool discard = false;
-
-        while(fgets(buf, sizeof(buf), this->current_file_handler) != NULL) {
-            int len = strlen(buf);
-            if(len == 0) continue; // empty line? should not be possible
-            if(buf[len - 1] == '\n' || feof(this->current_file_handler)) {
-                if(discard) { // we are discarding a long line
-                    discard = false;
-                    continue;
-                }
-                if(len == 1) continue; // empty line
+        if(played_cnt == 0) {
+            char magic[4];
+            int n = 0;
+            while(n < 4) {
+                int c = read_byte();
+                if(c < 0) break;
+                magic[n++] = c;
+            }
+            this->binary_file = (n == 4 && memcmp(magic, PLAYER_BINARY_MAGIC, 4) == 0);
+            if(!this->binary_file) {
+                // a text file, the first chunk is still in the buffer so start again from the beginning of it
+                read_pos = 0;
+                played_cnt = 0;
+            }
+        }
 
-                if(this->current_stream != nullptr) {
-                    this->current_stream->printf("%s", buf);
-                }
+        uint32_t start = us_ticker_read();
 
-                struct SerialMessage message;
-                message.message = buf;
-                message.stream = this->current_stream == nullptr ? &(StreamOutput::NullStream) : this->current_stream;
+        // feed as many lines as the queue will take without holding up the main loop for too long
+        bool played;
+        while((played = this->binary_file ? play_tokenized() : play_line())) {
+            // the line may have paused, aborted or changed the file
+            if(!this->playing_file || THEKERNEL->is_halted()) return;
 
-                // waits for the queue to have enough room
-                THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
-                played_cnt += len;
-                return; // we feed one line per main loop
+            if(THEKERNEL->conveyor->is_queue_full() || (us_ticker_read() - start) >= PLAYER_BATCH_US) break;
+        }
 
-            } else {
-                // discard long line
-                if(this->current_stream != nullptr) { this->current_stream->printf("Warning: Discarded long line\n"); }
-                discard = true;
+        if(!played) {
+            // the end of the file, the journal is cleared once the rest of the job has been done
+            if(this->journal_fd != nullptr) {
+                this->journal_done = true;
+                if(!this->journal_pending) journal_snapshot(true);
             }
+        } else {
+            if(this->journal_enable && this->journal_secs >= this->journal_interval && !this->journal_pending) journal_snapshot(false);
+            return;
         }
 
         this->playing_file = false;
         this->filename = "";
         played_cnt = 0;
+        read_pos = read_len = 0;
         file_size = 0;
         fclose(this->current_file_handler);
         current_file_handler = NULL;
@@ -454,6 +866,175 @@ void Player::on_main_loop(void *argument)
     }
 }
 
+// next byte of the file from read_buf, which is refilled from the file as needed, -1 at the end of the file
+int Player::read_byte()
+{
+    if(read_pos >= read_len) {
+        if(this->read_buf == nullptr) {
+            // only pay for the buffer once something is played
+            this->read_buf = (char *)AHB0.alloc(PLAYER_READ_SIZE);
+            if(this->read_buf == nullptr) this->read_buf = new char[PLAYER_READ_SIZE];
+        }
+        read_len = fread(read_buf, 1, PLAYER_READ_SIZE, current_file_handler);
+        read_pos = 0;
+        if(read_len == 0) return -1;
+    }
+
+    played_cnt++;
+    return (uint8_t)read_buf[read_pos++];
+}
+
+// zigzag encoded varint as written by gcode-pack.py
+bool Player::read_varint(int32_t& value)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = read_byte();
+        if(c < 0) return false;
+        v |= (uint32_t)(c & 0x7F) << shift;
+        if((c & 0x80) == 0) {
+            value = (v >> 1) ^ -(int32_t)(v & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Player::dispatch_line(const char *line)
+{
+    if(this->current_stream != nullptr) {
+        this->current_stream->printf("%s", line);
+    }
+
+    struct SerialMessage message;
+    message.message = line;
+    message.stream = this->current_stream == nullptr ? &(StreamOutput::NullStream) : this->current_stream;
+
+    // waits for the queue to have enough room
+    THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+}
+
+// reads the next line with its newline into buf, returns its length which is 0 at the end of the file.
+// too_long is set if the line did not fit, buf then has the start of it
+size_t Player::read_line(char *buf, size_t size, bool& too_long)
+{
+    size_t len = 0;
+    too_long = false;
+    int c;
+
+    while((c = read_byte()) >= 0) {
+        if(len < size - 1) buf[len++] = c;
+        else too_long = true;
+        if(c == '\n') break;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+// plays the next line of a text file, returns false at the end of the file
+bool Player::play_line()
+{
+    char buf[130]; // lines upto 128 characters are allowed, anything longer is discarded
+    bool too_long;
+
+    if(read_line(buf, sizeof(buf), too_long) == 0) return false;
+
+    if(too_long) {
+        // discard long line
+        if(this->current_stream != nullptr) { this->current_stream->printf("Warning: Discarded long line\n"); }
+
+    } else if(buf[0] != '\n') { // skip empty lines
+        dispatch_line(buf);
+    }
+
+    return true;
+}
+
+/*
+    plays the next record of a job tokenized by gcode-pack.py, returns false at the end of the file.
+    after the magic number the file is a list of records, all numbers are little endian
+        'G' or 'M', uint16 code, uint8 subcode, uint8 word count, then for each word
+            uint8 letter, int8 exponent (-128 if the word has no value), zigzag varint mantissa if it has a value
+        'L', uint8 length, then that many characters of a line that was left as text
+*/
+bool Player::play_tokenized()
+{
+    int op = read_byte();
+    if(op < 0) return false;
+
+    bool ok = false;
+    if(op == 'L') {
+        char buf[130];
+        int len = read_byte();
+        if(len >= 0 && len < (int)sizeof(buf)) {
+            int n = 0;
+            while(n < len) {
+                int c = read_byte();
+                if(c < 0) break;
+                buf[n++] = c;
+            }
+            buf[n] = '\0';
+            if(n == len) {
+                dispatch_line(buf);
+                ok = true;
+            }
+        }
+
+    } else if(op == 'G' || op == 'M') {
+        int lo = read_byte(), hi = read_byte(), subcode = read_byte(), n = read_byte();
+        if(lo >= 0 && hi >= 0 && subcode >= 0 && n >= 0) {
+            Gcode gcode(this->current_stream == nullptr ? &(StreamOutput::NullStream) : this->current_stream);
+            if(op == 'G') {
+                gcode.has_g = true;
+                gcode.g = lo | (hi << 8);
+            } else {
+                gcode.has_m = true;
+                gcode.m = lo | (hi << 8);
+            }
+            gcode.subcode = subcode;
+
+            // there is no text to echo with -v, so it is made from the record
+            char echo[130];
+            size_t elen = 0;
+            if(this->current_stream != nullptr) {
+                elen = snprintf(echo, sizeof(echo), subcode > 0 ? "%c%u.%d" : "%c%u", op, (unsigned)(lo | (hi << 8)), subcode);
+            }
+
+            ok = true;
+            for (int i = 0; i < n && ok; ++i) {
+                int letter = read_byte(), exponent = read_byte();
+                int32_t mantissa = 0;
+                ok = letter >= 0 && exponent >= 0;
+                if(ok && exponent != 0x80) {
+                    ok = read_varint(mantissa);
+                }
+                if(ok) {
+                    float value = Gcode::decimal_to_float(mantissa, (int8_t)exponent);
+                    gcode.add_word(letter, exponent != 0x80, value);
+                    if(this->current_stream != nullptr && elen + 26 < sizeof(echo)) {
+                        echo[elen++] = ' ';
+                        echo[elen++] = letter;
+                        if(exponent != 0x80) elen += format_float(&echo[elen], sizeof(echo) - elen, value, -(int8_t)exponent);
+                    }
+                }
+            }
+
+            if(ok) {
+                if(this->current_stream != nullptr) {
+                    this->current_stream->printf("%.*s\n", (int)elen, echo);
+                }
+                THEKERNEL->gcode_dispatch->dispatch_tokenized(&gcode);
+            }
+        }
+    }
+
+    if(!ok) {
+        THEKERNEL->streams->printf("Error: bad record at byte %lu of %s, stopped playing\r\n", played_cnt, this->filename.c_str());
+    }
+    return ok;
+}
+
 void Player::on_get_public_data(void *argument)
 {
     PublicDataRequest *pdr = static_cast<PublicDataRequest *>(argument);
@@ -601,46 +1182,13 @@ void Player::resume_command(string parameters, StreamOutput *stream )
     stream->printf("resuming print...\n");
 
     // wait for them to reach temp
-    if(!this->saved_temperatures.empty()) {
-        // set heaters to saved temps
-        for(auto& h : this->saved_temperatures) {
-            float t= h.second;
-            PublicData::set_value( temperature_control_checksum, h.first, &t );
-        }
-        stream->printf("Waiting for heaters...\n");
-        bool wait= true;
-        uint32_t tus= us_ticker_read(); // mbed call
-        while(wait) {
-            wait= false;
-
-            bool timeup= false;
-            if((us_ticker_read() - tus) >= 1000000) { // print every 1 second
-                timeup= true;
-                tus= us_ticker_read(); // mbed call
-            }
-
-            for(auto& h : this->saved_temperatures) {
-                struct pad_temperature temp;
-                if(PublicData::get_value( temperature_control_checksum, current_temperature_checksum, h.first, &temp )) {
-                    if(timeup)
-                        stream->printf("%s:%3.1f /%3.1f @%d ", temp.designator.c_str(), temp.current_temperature, ((temp.target_temperature == -1) ? 0.0 : temp.target_temperature), temp.pwm);
-                    wait= wait || (temp.current_temperature < h.second);
-                }
-            }
-            if(timeup) stream->printf("\n");
-
-            if(wait)
-                THEKERNEL->call_event(ON_IDLE, this);
-
-            if(THEKERNEL->is_halted()) {
-                // abort temp wait and rest of resume
-                THEKERNEL->streams->printf("Resume aborted by kill\n");
-                THEROBOT->pop_state();
-                this->saved_temperatures.clear();
-                suspended= false;
-                return;
-            }
-        }
+    if(!heat_saved_temperatures(stream)) {
+        // abort temp wait and rest of resume
+        THEKERNEL->streams->printf("Resume aborted by kill\n");
+        THEROBOT->pop_state();
+        this->saved_temperatures.clear();
+        suspended= false;
+        return;
     }
 
     // execute optional gcode if defined
@@ -686,3 +1234,295 @@ void Player::resume_command(string parameters, StreamOutput *stream )
     this->saved_temperatures.clear();
     suspended= false;
 }
+
+uint32_t Player::journal_checksum(const journal_record_t& rec)
+{
+    // Fletcher-32 over everything but the checksum itself
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&rec);
+    uint32_t a = 0xFFFF, b = 0xFFFF;
+    for (size_t i = 0; i < offsetof(journal_record_t, checksum); ++i) {
+        a = (a + p[i]) % 0xFFFF;
+        b = (b + a) % 0xFFFF;
+    }
+    return (b << 16) | a;
+}
+
+// take a snapshot of where the job is, it is written once the motion queued so far has been done so that the
+// file offset and the position match
+void Player::journal_snapshot(bool done)
+{
+    // the journal is only opened once a job has been playing for a while, so short files like on_boot.gcode leave it alone
+    if(this->journal_fd == nullptr && !journal_open()) return;
+
+    journal_record_t& rec = *this->journal_rec;
+    memset(&rec, 0, sizeof(rec));
+    if(!done) {
+        rec.offset = this->played_cnt;
+        rec.file_size = this->file_size;
+        THEROBOT->get_axis_position(rec.pos);
+        rec.e = 0;
+        #if MAX_ROBOT_ACTUATORS > 3
+        int extruder = THEROBOT->get_active_extruder();
+        if(extruder > 0) rec.e = THEROBOT->get_axis_position(extruder);
+        #endif
+        rec.feed_rate = THEROBOT->get_feed_rate();
+        if(!THEROBOT->absolute_mode) rec.flags |= PLAYER_STATE_RELATIVE;
+        if(!THEROBOT->e_absolute_mode) rec.flags |= PLAYER_STATE_RELATIVE_E;
+        if(THEROBOT->inch_mode) rec.flags |= PLAYER_STATE_INCHES;
+        if(this->binary_file) rec.flags |= PLAYER_STATE_BINARY;
+
+        std::vector<struct pad_temperature> controllers;
+        if(PublicData::get_value(temperature_control_checksum, poll_controls_checksum, &controllers)) {
+            for (auto &c : controllers) {
+                if(c.target_temperature > 0 && rec.n_heaters < PLAYER_JOURNAL_HEATERS) {
+                    rec.heater_id[rec.n_heaters] = c.id;
+                    rec.heater_temp[rec.n_heaters++] = c.target_temperature;
+                }
+            }
+        }
+        strncpy(rec.filename, this->filename.c_str(), sizeof(rec.filename) - 1);
+    }
+
+    this->journal_secs = 0;
+    this->journal_pending = true;
+    THEKERNEL->conveyor->queue_action(journal_reached, this, 0);
+}
+
+// open the journal for writing in place, creating it if need be
+bool Player::journal_open()
+{
+    journal_record_t last;
+    this->journal_seq = journal_read(last) ? last.seq : 0;
+
+    this->journal_fd = fopen(PLAYER_JOURNAL_FILE, "r+");
+    if(this->journal_fd != nullptr && (fseek(this->journal_fd, 0, SEEK_END) != 0 || ftell(this->journal_fd) != PLAYER_JOURNAL_SLOTS * 512)) {
+        fclose(this->journal_fd);
+        this->journal_fd = nullptr;
+    }
+    if(this->journal_fd == nullptr) {
+        // allocate it once, after that records are written in place
+        FILE *fd = fopen(PLAYER_JOURNAL_FILE, "w");
+        if(fd == nullptr) {
+            THEKERNEL->streams->printf("Error: could not create %s, journal disabled\r\n", PLAYER_JOURNAL_FILE);
+            this->journal_enable = false;
+            return false;
+        }
+        char zero[64];
+        memset(zero, 0, sizeof(zero));
+        for (int i = 0; i < PLAYER_JOURNAL_SLOTS * 512 / 64; ++i) fwrite(zero, 1, sizeof(zero), fd);
+        fclose(fd);
+        this->journal_fd = fopen(PLAYER_JOURNAL_FILE, "r+");
+        if(this->journal_fd == nullptr) {
+            this->journal_enable = false;
+            return false;
+        }
+    }
+    // whole sectors go straight to the card without the stdio buffer
+    setvbuf(this->journal_fd, nullptr, _IONBF, 0);
+    this->journal_rec = new journal_record_t;
+    return true;
+}
+
+// write an empty record so there is nothing to recover, whether or not the journal is open yet
+void Player::journal_clear()
+{
+    if(this->journal_fd == nullptr) {
+        if(!this->journal_enable) return;
+        journal_record_t last;
+        if(!journal_read(last) || last.filename[0] == '\0') return;
+        if(!journal_open()) return;
+    }
+    memset(this->journal_rec, 0, sizeof(journal_record_t));
+    journal_write();
+    journal_close();
+}
+
+// called from the conveyor once the motion before the snapshot has been done
+void Player::journal_reached(void *player, float)
+{
+    static_cast<Player *>(player)->journal_ready = true;
+}
+
+// write journal_rec over the oldest record, this is a single sector write
+void Player::journal_write()
+{
+    char sector[512];
+    memset(sector, 0, sizeof(sector));
+
+    journal_record_t& rec = *this->journal_rec;
+    memcpy(rec.magic, PLAYER_JOURNAL_MAGIC, 4);
+    rec.seq = ++this->journal_seq;
+    rec.checksum = journal_checksum(rec);
+    memcpy(sector, &rec, sizeof(rec));
+
+    if(fseek(this->journal_fd, (rec.seq % PLAYER_JOURNAL_SLOTS) * 512, SEEK_SET) != 0 || fwrite(sector, 1, sizeof(sector), this->journal_fd) != sizeof(sector)) {
+        THEKERNEL->streams->printf("Error: could not write %s\r\n", PLAYER_JOURNAL_FILE);
+    }
+}
+
+void Player::journal_close()
+{
+    fclose(this->journal_fd);
+    this->journal_fd = nullptr;
+    delete this->journal_rec;
+    this->journal_rec = nullptr;
+    this->journal_pending = false;
+    this->journal_ready = false;
+    this->journal_done = false;
+}
+
+// the latest valid record in the journal
+bool Player::journal_read(journal_record_t& rec)
+{
+    FILE *fd = fopen(PLAYER_JOURNAL_FILE, "r");
+    if(fd == nullptr) return false;
+
+    bool found = false;
+    journal_record_t r;
+    for (int i = 0; i < PLAYER_JOURNAL_SLOTS; ++i) {
+        if(fseek(fd, i * 512, SEEK_SET) != 0 || fread(&r, sizeof(r), 1, fd) != 1) break;
+        if(memcmp(r.magic, PLAYER_JOURNAL_MAGIC, 4) != 0 || r.checksum != journal_checksum(r)) continue;
+        if(!found || r.seq > rec.seq) {
+            rec = r;
+            found = true;
+        }
+    }
+    fclose(fd);
+
+    if(found) rec.filename[sizeof(rec.filename) - 1] = '\0';
+    return found;
+}
+
+// set the heaters in saved_temperatures and wait for them to get there, returns false if halted while waiting
+bool Player::heat_saved_temperatures(StreamOutput *stream)
+{
+    if(this->saved_temperatures.empty()) return true;
+
+    // set heaters to saved temps
+    for(auto& h : this->saved_temperatures) {
+        float t= h.second;
+        PublicData::set_value( temperature_control_checksum, h.first, &t );
+    }
+    stream->printf("Waiting for heaters...\n");
+    bool wait= true;
+    uint32_t tus= us_ticker_read(); // mbed call
+    while(wait) {
+        wait= false;
+
+        bool timeup= false;
+        if((us_ticker_read() - tus) >= 1000000) { // print every 1 second
+            timeup= true;
+            tus= us_ticker_read(); // mbed call
+        }
+
+        for(auto& h : this->saved_temperatures) {
+            struct pad_temperature temp;
+            if(PublicData::get_value( temperature_control_checksum, current_temperature_checksum, h.first, &temp )) {
+                if(timeup)
+                    stream->printf("%s:%3.1f /%3.1f @%d ", temp.designator.c_str(), temp.current_temperature, ((temp.target_temperature == -1) ? 0.0 : temp.target_temperature), temp.pwm);
+                wait= wait || (temp.current_temperature < h.second);
+            }
+        }
+        if(timeup) stream->printf("\n");
+
+        if(wait)
+            THEKERNEL->call_event(ON_IDLE, this);
+
+        if(THEKERNEL->is_halted()) return false;
+    }
+
+    return true;
+}
+
+/**
+carry on with a job that was interrupted by a power loss from the last point in the journal
+1. heat up to the journaled temperatures
+2. home X and Y, Z is assumed to not have moved while the power was off
+3. move back to the journaled position from above and restore E, the feedrate and modes
+4. play the file from the journaled offset
+*/
+void Player::recover_command( string parameters, StreamOutput *stream )
+{
+    if(this->playing_file || this->suspended) {
+        stream->printf("Currently printing, abort print first\r\n");
+        return;
+    }
+
+    journal_record_t rec;
+    if(!journal_read(rec) || rec.filename[0] == '\0') {
+        stream->printf("Nothing to recover\r\n");
+        return;
+    }
+
+    if(this->current_file_handler != NULL) {
+        fclose(this->current_file_handler);
+    }
+
+    this->current_file_handler = fopen(rec.filename, "r");
+    if(this->current_file_handler == NULL) {
+        stream->printf("File not found: %s\r\n", rec.filename);
+        return;
+    }
+    fseek(this->current_file_handler, 0, SEEK_END);
+    if((uint32_t)ftell(this->current_file_handler) != rec.file_size) {
+        stream->printf("%s has changed since it was played, can not recover\r\n", rec.filename);
+        fclose(this->current_file_handler);
+        this->current_file_handler = NULL;
+        return;
+    }
+
+    stream->printf("Recovering %s from byte %lu\r\n", rec.filename, rec.offset);
+    this->filename = rec.filename;
+    this->file_size = rec.file_size;
+    this->current_stream = nullptr;
+    this->reply_stream = nullptr;
+    this->elapsed_secs = 0;
+
+    this->saved_temperatures.clear();
+    for (int i = 0; i < rec.n_heaters; ++i) {
+        this->saved_temperatures[rec.heater_id[i]] = rec.heater_temp[i];
+    }
+    bool ok = heat_saved_temperatures(stream);
+    this->saved_temperatures.clear();
+    if(!ok) {
+        THEKERNEL->streams->printf("Recover aborted by kill\n");
+        fclose(this->current_file_handler);
+        this->current_file_handler = NULL;
+        return;
+    }
+
+    // NOTE positions were saved in MCS so must use G53 to restore them
+    // the nozzle is resting on the part, so Z is set from the journal and lifted clear before X and Y are homed
+    char buf[128];
+    dispatch_line("G21");
+    snprintf(buf, sizeof(buf), "G28.3 Z%f", rec.pos[2]);
+    dispatch_line(buf);
+    dispatch_line("G91");
+    snprintf(buf, sizeof(buf), "G0 Z%f", PLAYER_RESTART_LIFT);
+    dispatch_line(buf);
+    dispatch_line("G90");
+    dispatch_line("G28 X0 Y0");
+    snprintf(buf, sizeof(buf), "G53 G0 X%f Y%f", rec.pos[0], rec.pos[1]);
+    dispatch_line(buf);
+    snprintf(buf, sizeof(buf), "G53 G0 Z%f", rec.pos[2]);
+    dispatch_line(buf);
+    snprintf(buf, sizeof(buf), "G92 E%f", rec.e);
+    dispatch_line(buf);
+    snprintf(buf, sizeof(buf), "G1 F%f", rec.feed_rate);
+    dispatch_line(buf);
+    if(rec.flags & PLAYER_STATE_RELATIVE) dispatch_line("G91");
+    dispatch_line((rec.flags & PLAYER_STATE_RELATIVE_E) ? "M83" : "M82");
+    if(rec.flags & PLAYER_STATE_INCHES) dispatch_line("G20");
+
+    if(THEKERNEL->is_halted()) {
+        fclose(this->current_file_handler);
+        this->current_file_handler = NULL;
+        return;
+    }
+
+    fseek(this->current_file_handler, rec.offset, SEEK_SET);
+    this->played_cnt = rec.offset;
+    this->read_pos = this->read_len = 0;
+    this->binary_file = (rec.flags & PLAYER_STATE_BINARY) != 0;
+    this->playing_file = true;
+}
@@ -37,8 +37,45 @@ class Player : public Module {
         void abort_command( string parameters, StreamOutput* stream );
         void suspend_command( string parameters, StreamOutput* stream );
         void resume_command( string parameters, StreamOutput* stream );
+        void recover_command( string parameters, StreamOutput* stream );
+        bool heat_saved_temperatures(StreamOutput* stream);
         string extract_options(string& args);
         void suspend_part2();
+        int read_byte();
+        bool read_varint(int32_t& value);
+        size_t read_line(char *buf, size_t size, bool& too_long);
+        bool play_line();
+        bool play_tokenized();
+        void dispatch_line(const char *line);
+
+        // the modal state of a file at the start of a line, enough to start playing from there
+        struct play_state_t {
+            uint32_t line;      // 1 is the first line of the file
+            uint32_t offset;    // byte offset of the line
+            float pos[3];       // XYZ as written in the file
+            float e;
+            float feed_rate;
+            float hotend_temp;
+            float bed_temp;
+            float layer_z;      // Z of the layer this line starts, NAN if it does not start one
+            uint8_t flags;      // see PLAYER_STATE_*
+            uint8_t modal_g;    // last G0 to G3, used by lines with just coordinates
+        };
+        bool track_line(play_state_t& state, const char *line, size_t len);
+        bool build_index(const string& index_name, StreamOutput* stream);
+        bool find_start(const string& options, play_state_t& state, StreamOutput* stream);
+        void start_from(const play_state_t& state, StreamOutput* stream);
+
+        // power loss journal, see PLAYER_JOURNAL_FILE
+        struct journal_record_t;
+        void journal_snapshot(bool done);
+        bool journal_open();
+        void journal_clear();
+        void journal_write();
+        void journal_close();
+        bool journal_read(journal_record_t& rec);
+        static void journal_reached(void *player, float);
+        static uint32_t journal_checksum(const journal_record_t& rec);
 
         string filename;
         string after_suspend_gcode;
@@ -48,11 +85,20 @@ class Player : public Module {
         StreamOutput* reply_stream;
 
         FILE* current_file_handler;
+        char *read_buf;         // the file is read in PLAYER_READ_SIZE chunks into here, and split into lines from it
+        size_t read_pos;
+        size_t read_len;
         long file_size;
         unsigned long played_cnt;
         unsigned long elapsed_secs;
         float saved_position[3]; // only saves XYZ
         std::map<uint16_t, float> saved_temperatures;
+        FILE* journal_fd;
+        journal_record_t *journal_rec;  // the next record to write, it is written once the motion queued before it has been done
+        uint32_t journal_seq;
+        uint16_t journal_interval;
+        uint16_t journal_secs;
+        volatile bool journal_ready;    // set from the conveyor when the motion reaches journal_rec
         struct {
             bool on_boot_gcode_enable:1;
             bool booted:1;
@@ -61,6 +107,10 @@ class Player : public Module {
             bool was_playing_file:1;
             bool leave_heaters_on:1;
             bool override_leave_heaters_on:1;
+            bool binary_file:1;
+            bool journal_enable:1;
+            bool journal_pending:1;
+            bool journal_done:1;
             uint8_t suspend_loops:4;
         };
 };
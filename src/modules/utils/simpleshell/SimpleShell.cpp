@@ -27,6 +27,7 @@
 #include "GcodeDispatch.h"
 #include "BaseSolution.h"
 #include "StepperMotor.h"
+#include "StepTicker.h"
 #include "Configurator.h"
 #include "Block.h"
 
@@ -35,16 +36,19 @@
 #include "NetworkPublicAccess.h"
 #include "platform_memory.h"
 #include "SwitchPublicAccess.h"
+#include "ConveyorPublicAccess.h"
 #include "SDFAT.h"
 #include "Thermistor.h"
 #include "md5.h"
 #include "utils.h"
 #include "AutoPushPop.h"
+#include "CycleCounter.h"
 
 #include "system_LPC17xx.h"
 #include "LPC17xx.h"
 
 #include "mbed.h" // for wait_ms()
+#include "us_ticker_api.h"
 
 extern unsigned int g_maximumHeapAddress;
 
@@ -53,6 +57,7 @@ extern unsigned int g_maximumHeapAddress;
 #include <stdio.h>
 #include <stdint.h>
 #include <functional>
+#include <algorithm>
 
 extern "C" uint32_t  __end__;
 extern "C" uint32_t  __malloc_free_list;
@@ -69,6 +74,7 @@ const SimpleShell::ptentry_t SimpleShell::commands_table[] = {
     {"mv",       SimpleShell::mv_command},
     {"mkdir",    SimpleShell::mkdir_command},
     {"upload",   SimpleShell::upload_command},
+    {"bupload",  SimpleShell::bupload_command},
     {"reset",    SimpleShell::reset_command},
     {"dfu",      SimpleShell::dfu_command},
     {"break",    SimpleShell::break_command},
@@ -76,6 +82,10 @@ const SimpleShell::ptentry_t SimpleShell::commands_table[] = {
     {"?",        SimpleShell::help_command},
     {"version",  SimpleShell::version_command},
     {"mem",      SimpleShell::mem_command},
+    {"top",      SimpleShell::top_command},
+    {"isr",      SimpleShell::isr_command},
+    {"health",   SimpleShell::health_command},
+    {"trace",    SimpleShell::trace_command},
     {"get",      SimpleShell::get_command},
     {"set_temp", SimpleShell::set_temp_command},
     {"switch",   SimpleShell::switch_command},
@@ -153,7 +163,8 @@ static uint32_t heapWalk(StreamOutput *stream, bool verbose)
 void SimpleShell::on_module_loaded()
 {
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
-    this->register_for_event(ON_GCODE_RECEIVED);
+    this->register_for_gcode('M', 20);
+    this->register_for_gcode('M', 30);
     this->register_for_event(ON_SECOND_TICK);
 
     reset_delay_secs = 0;
@@ -264,7 +275,7 @@ void SimpleShell::on_console_line_received( void *argument )
         } else if (cmd == "config-load"){
             THEKERNEL->configurator->config_load_command(  possible_command, new_message.stream );
 
-        } else if (cmd == "play" || cmd == "progress" || cmd == "abort" || cmd == "suspend" || cmd == "resume") {
+        } else if (cmd == "play" || cmd == "progress" || cmd == "abort" || cmd == "suspend" || cmd == "resume" || cmd == "recover") {
             // these are handled by Player module
 
         } else if (cmd == "fire") {
@@ -509,6 +520,141 @@ void SimpleShell::upload_command( string parameters, StreamOutput *stream )
     } while(c != 4 && c != 26);
 }
 
+/*
+    binary upload, the host waits for "ready <max data> <window>" then sends packets of
+        STX, seq (u8), length (u16), data, crc32 of seq, length and data (u32), all little endian
+    up to <window> packets may be sent ahead of their "ack <seq>". A packet that is bad or out of order gets
+    "nak <seq>" once the input goes quiet, the host then sends again from that packet. A zero length packet
+    ends the upload and length 0xFFFF aborts it.
+*/
+#define BUPLOAD_STX 0x02
+#define BUPLOAD_MAX_DATA 1024
+#define BUPLOAD_WINDOW 4
+#define BUPLOAD_BUFFER_SIZE 4096 // written to the file in whole buffers so the sectors go straight to the card
+#define BUPLOAD_TIMEOUT_US 10000000
+#define BUPLOAD_QUIET_US 50000
+
+// next byte from the stream, -1 if nothing arrives in time
+static int bupload_getc(StreamOutput *stream, uint32_t timeout_us)
+{
+    uint32_t start = us_ticker_read();
+    while(!stream->ready()) {
+        if((us_ticker_read() - start) >= timeout_us) return -1;
+        THEKERNEL->call_event(ON_IDLE);
+    }
+    return stream->_getc() & 0xFF;
+}
+
+static bool bupload_read(StreamOutput *stream, uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        int c = bupload_getc(stream, BUPLOAD_TIMEOUT_US);
+        if(c < 0) return false;
+        buf[i] = c;
+    }
+    return true;
+}
+
+void SimpleShell::bupload_command( string parameters, StreamOutput *stream )
+{
+    // like upload this blocks everything else until it is done
+    if(!THECONVEYOR->is_idle()) {
+        stream->printf("upload not allowed while printing or busy\n");
+        return;
+    }
+
+    string upload_filename = absolute_from_relative( parameters );
+    FILE *fd = fopen(upload_filename.c_str(), "w");
+    if(fd == NULL) {
+        stream->printf("failed to open file: %s.\r\n", upload_filename.c_str());
+        return;
+    }
+
+    if(!stream->set_binary_mode(true)) {
+        fclose(fd);
+        remove(upload_filename.c_str());
+        stream->printf("binary upload is not supported on this port, use upload\r\n");
+        return;
+    }
+
+    // whole buffers are written without going through the stdio buffer, a packet is received after the data so far
+    setvbuf(fd, nullptr, _IONBF, 0);
+    uint8_t *buf = (uint8_t *)AHB0.alloc(BUPLOAD_BUFFER_SIZE + BUPLOAD_MAX_DATA);
+    bool ahb = buf != nullptr;
+    if(!ahb) buf = new uint8_t[BUPLOAD_BUFFER_SIZE + BUPLOAD_MAX_DATA];
+
+    stream->printf("ready %d %d\n", BUPLOAD_MAX_DATA, BUPLOAD_WINDOW);
+
+    const char *error = nullptr;
+    uint8_t seq = 0;
+    bool nakked = false;
+    size_t fill = 0;
+    uint32_t total = 0;
+
+    while(true) {
+        int c = bupload_getc(stream, BUPLOAD_TIMEOUT_US);
+        if(c < 0) {
+            error = "timeout";
+            break;
+        }
+        if(c != BUPLOAD_STX) continue; // looking for the start of a packet
+
+        uint8_t hdr[3], crc[4];
+        bool ok = bupload_read(stream, hdr, sizeof(hdr));
+        uint16_t len = hdr[1] | (hdr[2] << 8);
+        if(ok && len == 0xFFFF) {
+            error = "aborted by host";
+            break;
+        }
+
+        ok = ok && len <= BUPLOAD_MAX_DATA && bupload_read(stream, buf + fill, len) && bupload_read(stream, crc, sizeof(crc));
+        ok = ok && crc32(buf + fill, len, crc32(hdr, sizeof(hdr))) == (uint32_t)(crc[0] | (crc[1] << 8) | (crc[2] << 16) | (crc[3] << 24));
+        if(!ok || hdr[0] != seq) {
+            // the host keeps sending upto its window, so wait for that to stop then ask for this packet again
+            if(!ok || !nakked) {
+                while(bupload_getc(stream, BUPLOAD_QUIET_US) >= 0) ;
+                stream->printf("nak %d\n", seq);
+                nakked = true;
+            }
+            continue;
+        }
+        nakked = false;
+
+        if(len == 0) {
+            // end of file
+            if(fill > 0 && fwrite(buf, 1, fill, fd) != fill) error = "write failed";
+            else stream->printf("ack %d\n", seq);
+            break;
+        }
+
+        fill += len;
+        total += len;
+        if(fill >= BUPLOAD_BUFFER_SIZE) {
+            if(fwrite(buf, 1, BUPLOAD_BUFFER_SIZE, fd) != BUPLOAD_BUFFER_SIZE) {
+                error = "write failed";
+                break;
+            }
+            fill -= BUPLOAD_BUFFER_SIZE;
+            memmove(buf, buf + BUPLOAD_BUFFER_SIZE, fill);
+        }
+        stream->printf("ack %d\n", seq++);
+    }
+
+    if(ahb) AHB0.dealloc(buf);
+    else delete [] buf;
+    fclose(fd);
+
+    if(error != nullptr) {
+        // do not let the rest of what the host sent be taken as commands
+        while(bupload_getc(stream, BUPLOAD_QUIET_US) >= 0) ;
+        remove(upload_filename.c_str());
+    }
+    stream->set_binary_mode(false);
+
+    if(error != nullptr) stream->printf("error: upload %s\r\n", error);
+    else stream->printf("uploaded %lu bytes\r\n", total);
+}
+
 // loads the specified config-override file
 void SimpleShell::load_command( string parameters, StreamOutput *stream )
 {
@@ -595,6 +741,118 @@ void SimpleShell::mem_command( string parameters, StreamOutput *stream)
     stream->printf("Block size: %u bytes, Tickinfo size: %u bytes\n", sizeof(Block), sizeof(Block::tickinfo_t) * Block::n_actuators);
 }
 
+// show the time each module spends in its event handlers, worst first
+void SimpleShell::top_command( string parameters, StreamOutput *stream)
+{
+    string opt = shift_parameter( parameters );
+    if (opt == "on" || opt == "off") {
+        THEKERNEL->enable_event_profiling(opt == "on");
+        stream->printf("event profiling %s\r\n", opt.c_str());
+        return;
+    }
+
+    if (!THEKERNEL->is_event_profiling()) {
+        stream->printf("event profiling is off, use top on\r\n");
+        return;
+    }
+
+    if (opt == "reset") {
+        THEKERNEL->reset_event_profile();
+        stream->printf("event profile reset\r\n");
+        return;
+    }
+
+    static const char *event_names[NUMBER_OF_DEFINED_EVENTS] = {
+        "main_loop", "console_line", "gcode", "idle", "second_tick", "get_public", "set_public", "halt", "enable"
+    };
+
+    // copy as printing can call events which update the profile
+    std::vector<std::pair<int, Kernel::event_profile_t>> entries;
+    for (int e = 0; e < NUMBER_OF_DEFINED_EVENTS; ++e) {
+        for (auto& p : THEKERNEL->get_event_profile((_EVENT_ENUM)e)) {
+            entries.push_back(std::make_pair(e, p));
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const std::pair<int, Kernel::event_profile_t>& a, const std::pair<int, Kernel::event_profile_t>& b) {
+        return a.second.total_cycles > b.second.total_cycles;
+    });
+
+    uint32_t elapsed = us_ticker_read() - THEKERNEL->get_event_profile_start();
+    stream->printf("%lu ms since reset, times include any events called by the handler\r\n", elapsed / 1000);
+    stream->printf(" %%time   total ms     calls   min us   avg us   max us event        module (vtable)\r\n");
+    for (auto& i : entries) {
+        const Kernel::event_profile_t& p = i.second;
+        uint32_t total = cycles_to_us(p.total_cycles);
+        stream->printf("%6.2f %10lu %9lu %8lu %8lu %8lu %-12s %p (%08lX)\r\n",
+                       elapsed > 0 ? 100.0F * total / elapsed : 0.0F, total / 1000, p.calls,
+                       cycles_to_us(p.min_cycles), total / p.calls, cycles_to_us(p.max_cycles),
+                       event_names[i.first], p.module, *(uint32_t *)p.module);
+    }
+}
+
+// show how much of the step period the stepping interrupts use
+void SimpleShell::isr_command( string parameters, StreamOutput *stream)
+{
+    StepTicker *st = THEKERNEL->step_ticker;
+    string opt = shift_parameter( parameters );
+    if (opt == "on" || opt == "off") {
+        st->enable_isr_profiling(opt == "on");
+        stream->printf("isr profiling %s\r\n", opt.c_str());
+
+    } else if (!st->is_isr_profiling()) {
+        stream->printf("isr profiling is off, use isr on\r\n");
+
+    } else if (opt == "reset") {
+        st->reset_isr_profile();
+        stream->printf("isr profile reset\r\n");
+
+    } else {
+        st->dump_isr_profile(stream);
+    }
+}
+
+// show how well the motion pipeline has been kept fed
+void SimpleShell::health_command( string parameters, StreamOutput *stream)
+{
+    if (shift_parameter( parameters ) == "reset") {
+        THECONVEYOR->reset_health();
+        stream->printf("motion health counters reset\r\n");
+        return;
+    }
+
+    struct pad_conveyor_health h;
+    THECONVEYOR->get_health(h);
+    stream->printf("blocks: %lu, average queue depth: %1.1f\r\n", h.blocks, h.average_depth);
+    stream->printf("underruns: %lu, starved for: %lu ms\r\n", h.underruns, h.starved_ms);
+    stream->printf("blocks refused as locked: %lu\r\n", h.locked_refusals);
+}
+
+// dump or save the trace of completed blocks
+void SimpleShell::trace_command( string parameters, StreamOutput *stream)
+{
+    if (!THECONVEYOR->is_tracing()) {
+        stream->printf("block trace is not enabled, set block_trace_size in config\r\n");
+        return;
+    }
+
+    string opt = shift_parameter( parameters );
+    if (opt.empty()) {
+        THECONVEYOR->dump_trace(stream);
+
+    } else if (opt == "reset") {
+        THECONVEYOR->reset_trace();
+        stream->printf("block trace reset\r\n");
+
+    } else {
+        string fn = absolute_from_relative(opt);
+        if (THECONVEYOR->save_trace(fn.c_str())) {
+            stream->printf("block trace saved to %s\r\n", fn.c_str());
+        } else {
+            stream->printf("could not open %s\r\n", fn.c_str());
+        }
+    }
+}
+
 static uint32_t getDeviceType()
 {
 #define IAP_LOCATION 0x1FFF1FF1
@@ -1138,6 +1396,10 @@ void SimpleShell::help_command( string parameters, StreamOutput *stream )
     stream->printf("Commands:\r\n");
     stream->printf("version\r\n");
     stream->printf("mem [-v]\r\n");
+    stream->printf("top [on|off|reset] - time spent in each module's event handlers\r\n");
+    stream->printf("isr [on|off|reset] - step interrupt load and latency\r\n");
+    stream->printf("health [reset] - motion queue underruns and starvation\r\n");
+    stream->printf("trace [reset|file] - hex dump, reset or save the trace of completed blocks\r\n");
     stream->printf("ls [-s] [folder]\r\n");
     stream->printf("cd folder\r\n");
     stream->printf("pwd\r\n");
@@ -1145,9 +1407,10 @@ void SimpleShell::help_command( string parameters, StreamOutput *stream )
     stream->printf("rm file\r\n");
     stream->printf("mv file newfile\r\n");
     stream->printf("remount\r\n");
-    stream->printf("play file [-v]\r\n");
+    stream->printf("play file [-v] [-l line | -z height]\r\n");
     stream->printf("progress - shows progress of current play\r\n");
     stream->printf("abort - abort currently playing file\r\n");
+    stream->printf("recover - continue a job interrupted by a power loss\r\n");
     stream->printf("reset - reset smoothie\r\n");
     stream->printf("dfu - enter dfu boot loader\r\n");
     stream->printf("break - break into debugger\r\n");
@@ -1161,6 +1424,7 @@ void SimpleShell::help_command( string parameters, StreamOutput *stream )
     stream->printf("load [file] - loads a configuration override file from soecified name or config-override\r\n");
     stream->printf("save [file] - saves a configuration override file as specified filename or as config-override\r\n");
     stream->printf("upload filename - saves a stream of text to the named file\r\n");
+    stream->printf("bupload filename - binary upload to the named file, see smoothie-serial-upload.py\r\n");
     stream->printf("calc_thermistor [-s0] T1,R1,T2,R2,T3,R3 - calculate the Steinhart Hart coefficients for a thermistor\r\n");
     stream->printf("thermistors - print out the predefined thermistors\r\n");
     stream->printf("md5sum file - prints md5 sum of the given file\r\n");
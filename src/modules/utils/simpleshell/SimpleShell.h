@@ -38,6 +38,7 @@ private:
     static void mv_command(string parameters, StreamOutput *stream );
     static void mkdir_command(string parameters, StreamOutput *stream );
     static void upload_command(string parameters, StreamOutput *stream );
+    static void bupload_command(string parameters, StreamOutput *stream );
     static void break_command(string parameters, StreamOutput *stream );
     static void reset_command(string parameters, StreamOutput *stream );
     static void dfu_command(string parameters, StreamOutput *stream );
@@ -51,6 +52,10 @@ private:
 
     static void switch_command(string parameters, StreamOutput *stream );
     static void mem_command(string parameters, StreamOutput *stream );
+    static void top_command(string parameters, StreamOutput *stream );
+    static void isr_command(string parameters, StreamOutput *stream );
+    static void health_command(string parameters, StreamOutput *stream );
+    static void trace_command(string parameters, StreamOutput *stream );
 
     static void net_command( string parameters, StreamOutput *stream);
 
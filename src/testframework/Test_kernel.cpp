@@ -28,6 +28,7 @@ This is aprt of the Smoothie test framework, it generates a Mockable Kernl so ke
 #include "modules/robot/Robot.h"
 #include "modules/robot/Stepper.h"
 #include "modules/robot/Conveyor.h"
+#include "Gcode.h"
 
 #include "Config.h"
 #include "FirmConfigSource.h"
@@ -77,12 +78,33 @@ void Kernel::register_for_event(_EVENT_ENUM id_event, Module *mod){
     this->hooks[id_event].push_back(mod);
 }
 
+// Adds a hook for a given module and gcode, unsorted here as tests only register a few
+void Kernel::register_for_gcode(char letter, uint16_t code, Module *mod){
+    this->gcode_hooks.push_back({(uint16_t)((letter == 'M' ? 0x8000 : 0) | (code & 0x7FFF)), mod});
+}
+
+// not in module order here, tests do not rely on it
+void Kernel::call_gcode_handlers(Gcode *gcode){
+    for (auto m : hooks[ON_GCODE_RECEIVED]) {
+        m->on_gcode_received(gcode);
+    }
+    uint16_t code= gcode->has_m ? 0x8000 | gcode->m : gcode->g;
+    if(!gcode->has_m && !gcode->has_g) return;
+    for (auto& h : gcode_hooks) {
+        if(h.code == code) h.module->on_gcode_received(gcode);
+    }
+}
+
 static std::map<_EVENT_ENUM, std::function<void(void*)> > event_callbacks;
 
 // Call a specific event with an argument
 void Kernel::call_event(_EVENT_ENUM id_event, void * argument){
-    for (auto m : hooks[id_event]) {
-        (m->*kernel_callback_functions[id_event])(argument);
+    if(id_event == ON_GCODE_RECEIVED) {
+        call_gcode_handlers(static_cast<Gcode *>(argument));
+    } else {
+        for (auto m : hooks[id_event]) {
+            (m->*kernel_callback_functions[id_event])(argument);
+        }
     }
     if(event_callbacks.find(id_event) != event_callbacks.end()){
         event_callbacks[id_event](argument);
@@ -97,11 +119,22 @@ bool Kernel::kernel_has_event(_EVENT_ENUM id_event, Module *mod)
     for (auto m : hooks[id_event]) {
         if(m == mod) return true;
     }
+    if(id_event == ON_GCODE_RECEIVED) {
+        for (auto& h : gcode_hooks) {
+            if(h.module == mod) return true;
+        }
+    }
     return false;
 }
 
 void Kernel::unregister_for_event(_EVENT_ENUM id_event, Module *mod)
 {
+    if(id_event == ON_GCODE_RECEIVED) {
+        for (auto i = gcode_hooks.begin(); i != gcode_hooks.end(); ) {
+            if(i->module == mod) i = gcode_hooks.erase(i);
+            else ++i;
+        }
+    }
     for (auto i = hooks[id_event].begin(); i != hooks[id_event].end(); ++i) {
         if(*i == mod) {
             hooks[id_event].erase(i);
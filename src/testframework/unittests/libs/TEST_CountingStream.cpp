@@ -0,0 +1,78 @@
+#include "CountingStream.h"
+
+#include <string>
+
+#include "easyunit/test.h"
+
+// keeps everything sent to it
+class CaptureStream : public StreamOutput {
+    public:
+        int puts(const char *str) { text += str; return strlen(str); }
+        std::string text;
+};
+
+TEST(CountingStreamTest,drops_ok)
+{
+    CaptureStream cap;
+    CountingStream cs(&cap);
+    cs.next_line();
+
+    cs.puts("ok\r\n");
+    ASSERT_TRUE(cap.text.empty());
+
+    // the ok and its newline in separate calls
+    cs.next_line();
+    cs.puts("ok");
+    cs.puts("\r\n");
+    ASSERT_TRUE(cap.text.empty());
+
+    // what follows the ok is still sent
+    cs.next_line();
+    cs.printf("ok %s\r\n", "T:21.0 /0.0 @0");
+    ASSERT_TRUE(cap.text == "T:21.0 /0.0 @0\r\n");
+
+    cap.text.clear();
+    cs.puts("X:1.0 Y:2.0\r\nok\r\n");
+    cs.puts("ok\r\nC: X:1.0\r\n");
+    ASSERT_TRUE(cap.text == "X:1.0 Y:2.0\r\nC: X:1.0\r\n");
+
+    // an ok that is not at the start of a line is not a reply
+    cap.text.clear();
+    cs.puts("file ok\r\n");
+    cs.puts("okay\r\n");
+    ASSERT_TRUE(cap.text == "file ok\r\nokay\r\n");
+}
+
+TEST(CountingStreamTest,tags_errors)
+{
+    CaptureStream cap;
+    CountingStream cs(&cap);
+
+    cs.next_line();
+    cs.next_line();
+    cs.next_line();
+
+    // an error written in pieces is tagged once, at its start
+    cs.puts("Error: ");
+    cs.puts("unknown\r\n");
+    ASSERT_TRUE(cap.text == "line 3: Error: unknown\r\n");
+
+    cap.text.clear();
+    cs.next_line();
+    cs.puts("!!\r\n");
+    cs.puts("error:Alarm lock\n");
+    ASSERT_TRUE(cap.text == "line 4: !!\r\nline 4: error:Alarm lock\n");
+
+    // after a dropped ok the next line is still recognised
+    cap.text.clear();
+    cs.next_line();
+    cs.puts("ok");
+    cs.puts("\r\nError: bad\r\n");
+    ASSERT_TRUE(cap.text == "line 5: Error: bad\r\n");
+
+    cs.reset();
+    cap.text.clear();
+    cs.next_line();
+    cs.puts("!!\r\n");
+    ASSERT_TRUE(cap.text == "line 1: !!\r\n");
+}
@@ -0,0 +1,76 @@
+#include "MeatPack.h"
+
+#include <string>
+#include <string.h>
+
+#include "easyunit/test.h"
+
+// packs like fast-stream.py, two 4 bit codes per byte with 15 meaning the character follows as a whole byte
+static std::string pack(const char *line, bool no_spaces)
+{
+    const char *table= no_spaces ? "0123456789.E\nGX" : "0123456789. \nGX";
+    std::string out;
+    size_t len= strlen(line);
+    for (size_t i = 0; i < len; i += 2) {
+        char pair[2]= {line[i], i + 1 < len ? line[i + 1] : '\0'};
+        int codes[2];
+        for (int j = 0; j < 2; ++j) {
+            const char *p= pair[j] == '\0' ? table : strchr(table, pair[j]);
+            codes[j]= p == nullptr ? 15 : p - table;
+        }
+        out += (char)(codes[0] | (codes[1] << 4));
+        for (int j = 0; j < 2; ++j) {
+            if(codes[j] == 15) out += pair[j];
+        }
+    }
+    return out;
+}
+
+static std::string unpack(MeatPack& mp, const std::string& in)
+{
+    std::string out;
+    char d[2];
+    for(char c : in) {
+        int n= mp.decode(c, d);
+        out.append(d, n);
+    }
+    return out;
+}
+
+TEST(MeatPackTest,off)
+{
+    MeatPack mp;
+    ASSERT_EQUALS_V(MeatPack::OFF, mp.get_mode());
+    ASSERT_TRUE(unpack(mp, "G1 X1 Y-2\n") == "G1 X1 Y-2\n");
+}
+
+TEST(MeatPackTest,packed_round_trip)
+{
+    MeatPack mp;
+    mp.set_mode(MeatPack::PACKED);
+
+    // Y- and F1 are pairs where both or the first are whole bytes, and the newline ends an odd length line
+    const char *line= "G1 X10.5 Y-3 F1200 M12\n";
+    std::string packed= pack(line, false);
+    ASSERT_TRUE(packed.size() < strlen(line));
+    ASSERT_TRUE(unpack(mp, packed) == line);
+
+    // every character a whole byte
+    const char *odd= "MY-F;\n";
+    ASSERT_TRUE(unpack(mp, pack(odd, false)) == odd);
+}
+
+TEST(MeatPackTest,packed_no_spaces)
+{
+    MeatPack mp;
+    mp.set_mode(MeatPack::PACKED_NO_SPACES);
+
+    const char *line= "G1X10.5Y-3E2.25F1200\n";
+    ASSERT_TRUE(unpack(mp, pack(line, true)) == line);
+
+    // changing the mode forgets a half decoded byte
+    char d[2];
+    ASSERT_EQUALS_V(0, mp.decode(0xFF, d));
+    mp.set_mode(MeatPack::PACKED_NO_SPACES);
+    ASSERT_TRUE(unpack(mp, pack("G0X1\n", true)) == "G0X1\n");
+}
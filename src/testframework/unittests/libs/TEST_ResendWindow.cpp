@@ -0,0 +1,121 @@
+#include "utils/ResendWindow.h"
+
+#include "easyunit/test.h"
+
+TEST(ResendWindowTest,in_order)
+{
+    ResendWindow rw;
+    ASSERT_EQUALS_V(0, rw.next_line());
+
+    rw.set_line(9);
+    ASSERT_EQUALS_V(10, rw.next_line());
+    ASSERT_TRUE(rw.check(10, 33, true, 0) == ResendWindow::RUN);
+    ASSERT_TRUE(rw.check(11, 34, true, 0) == ResendWindow::RUN);
+    ASSERT_EQUALS_V(12, rw.next_line());
+}
+
+TEST(ResendWindowTest,bad_resend)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+
+    // a bad line asks for a resend, the lines already sent after it are dropped
+    ASSERT_TRUE(rw.check(1, 10, false, 1000) == ResendWindow::RESEND);
+    ASSERT_TRUE(rw.check(2, 11, true, 1010) == ResendWindow::DROP);
+    ASSERT_TRUE(rw.check(3, 12, true, 1020) == ResendWindow::DROP);
+
+    // the line asked for arrives bad again, asked for again
+    ASSERT_TRUE(rw.check(1, 10, false, 1030) == ResendWindow::RESEND);
+    ASSERT_EQUALS_V(1, rw.next_line());
+
+    // then good
+    ASSERT_TRUE(rw.check(1, 10, true, 1040) == ResendWindow::RUN);
+    ASSERT_TRUE(rw.check(2, 11, true, 1050) == ResendWindow::RUN);
+    ASSERT_EQUALS_V(3, rw.next_line());
+
+    // a later bad line asks again
+    ASSERT_TRUE(rw.check(3, 12, false, 1060) == ResendWindow::RESEND);
+}
+
+TEST(ResendWindowTest,lost_resend)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+
+    ASSERT_TRUE(rw.check(1, 10, false, 0) == ResendWindow::RESEND);
+    ASSERT_TRUE(rw.check(2, 11, true, GCODE_RESEND_INTERVAL_US - 1) == ResendWindow::DROP);
+
+    // the host never saw the rs and keeps sending, it is asked again now and then
+    ASSERT_TRUE(rw.check(3, 12, true, GCODE_RESEND_INTERVAL_US) == ResendWindow::RESEND);
+    ASSERT_TRUE(rw.check(4, 13, true, GCODE_RESEND_INTERVAL_US + 1) == ResendWindow::DROP);
+    ASSERT_TRUE(rw.check(5, 14, true, 2 * GCODE_RESEND_INTERVAL_US) == ResendWindow::RESEND);
+    ASSERT_EQUALS_V(1, rw.next_line());
+}
+
+TEST(ResendWindowTest,duplicate)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+    for (int i = 1; i <= 5; ++i) {
+        ASSERT_TRUE(rw.check(i, 100 + i, true, 0) == ResendWindow::RUN);
+    }
+
+    // the host went back further than asked, lines already run are only acknowledged
+    ASSERT_TRUE(rw.check(3, 103, true, 0) == ResendWindow::DUPLICATE);
+    ASSERT_TRUE(rw.check(5, 105, true, 0) == ResendWindow::DUPLICATE);
+    ASSERT_TRUE(rw.check(6, 106, true, 0) == ResendWindow::RUN);
+}
+
+TEST(ResendWindowTest,mismatch)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+    for (int i = 1; i <= 5; ++i) {
+        ASSERT_TRUE(rw.check(i, 100 + i, true, 0) == ResendWindow::RUN);
+    }
+
+    // same number, different line
+    ASSERT_TRUE(rw.check(4, 42, true, 0) == ResendWindow::MISMATCH);
+
+    // older than the window
+    for (int i = 6; i <= GCODE_RESEND_WINDOW + 6; ++i) {
+        ASSERT_TRUE(rw.check(i, 100 + i, true, 0) == ResendWindow::RUN);
+    }
+    ASSERT_TRUE(rw.check(7, 107, true, 0) == ResendWindow::DUPLICATE);
+    ASSERT_TRUE(rw.check(6, 106, true, 0) == ResendWindow::MISMATCH);
+
+    // M110 forgets them
+    rw.set_line(20);
+    ASSERT_TRUE(rw.check(20, 120, true, 0) == ResendWindow::MISMATCH);
+}
+
+TEST(ResendWindowTest,no_checksum)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+    for (int i = 1; i <= 5; ++i) {
+        ASSERT_TRUE(rw.check(i, -1, true, 0) == ResendWindow::RUN);
+    }
+
+    // an old line without a checksum can not be matched, the host is told which line comes next
+    ASSERT_TRUE(rw.check(4, -1, true, 0) == ResendWindow::RESEND);
+    ASSERT_EQUALS_V(6, rw.next_line());
+    ASSERT_TRUE(rw.check(5, -1, true, 10) == ResendWindow::DROP);
+    ASSERT_TRUE(rw.check(6, -1, true, 20) == ResendWindow::RUN);
+}
+
+TEST(ResendWindowTest,negative_line)
+{
+    ResendWindow rw;
+    rw.set_line(0);
+
+    ASSERT_TRUE(rw.check(-5, 10, true, 0) == ResendWindow::RESEND);
+    ASSERT_TRUE(rw.check(-5, 10, true, 10) == ResendWindow::DROP);
+    ASSERT_TRUE(rw.check(1, 10, true, 20) == ResendWindow::RUN);
+
+    // M110 with a negative line starts again from line 0
+    rw.set_line(-5);
+    ASSERT_EQUALS_V(0, rw.next_line());
+    ASSERT_TRUE(rw.check(-4, 10, true, 0) == ResendWindow::RESEND);
+    ASSERT_TRUE(rw.check(0, 10, true, 10) == ResendWindow::RUN);
+}
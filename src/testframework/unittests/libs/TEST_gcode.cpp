@@ -60,3 +60,105 @@ TEST(GCodeTest,subcode)
     ASSERT_EQUALS_DELTA_V(2.3, gc4.get_value('Y'), 0.001);
 
 }
+
+TEST(GCodeTest,words)
+{
+    Gcode gc1("N10 G1 X-.5 Y 3 E+2.25*45", nullptr, false);
+    ASSERT_TRUE(gc1.has_g);
+    ASSERT_EQUALS_V(1, gc1.g);
+    ASSERT_EQUALS_V(10, gc1.get_int('N'));
+    ASSERT_EQUALS_V(45, gc1.get_int('*'));
+    ASSERT_EQUALS_DELTA_V(-0.5, gc1.get_value('X'), 0.0001);
+    ASSERT_EQUALS_DELTA_V(3.0, gc1.get_value('Y'), 0.0001);
+    ASSERT_EQUALS_DELTA_V(2.25, gc1.get_value('E'), 0.0001);
+    ASSERT_TRUE(!gc1.has_letter('Z'));
+
+    // letter with no value
+    Gcode gc2("G28 X", nullptr);
+    ASSERT_TRUE(!gc2.has_letter('G'));
+    ASSERT_TRUE(gc2.has_letter('X'));
+    ASSERT_EQUALS_V(0, gc2.get_value('X'));
+    ASSERT_EQUALS_V(1, gc2.get_num_args());
+
+    // rest of line is available for filenames etc
+    Gcode gc3("M23 foo.g", nullptr);
+    ASSERT_TRUE(gc3.has_m);
+    ASSERT_EQUALS_V(23, gc3.m);
+    ASSERT_TRUE(strcmp(gc3.get_command(), " foo.g") == 0);
+
+    // large integers are exact
+    Gcode gc4("M561 A1067030938 B3", nullptr);
+    ASSERT_EQUALS_V(1067030938U, gc4.get_uint('A'));
+    ASSERT_EQUALS_V(3, gc4.get_uint('B'));
+}
+
+TEST(GCodeTest,long_numbered_text)
+{
+    // the text of a message or filename is not split into words so the checksum is never lost
+    Gcode gc1("N10 M117 PRINTING LAYER 5 OF 200 WITH A VERY LONG MESSAGE TEXT ABCDEFGHIJKLM*45", nullptr, false);
+    ASSERT_TRUE(gc1.has_m);
+    ASSERT_EQUALS_V(117, gc1.m);
+    ASSERT_EQUALS_V(10, gc1.get_int('N'));
+    ASSERT_TRUE(gc1.has_letter('*'));
+    ASSERT_EQUALS_V(45, gc1.get_int('*'));
+    ASSERT_TRUE(!gc1.has_letter('P'));
+
+    Gcode gc2("N5 M23 /SD/FILENAME.GCO*12", nullptr, false);
+    ASSERT_EQUALS_V(23, gc2.m);
+    ASSERT_EQUALS_V(5, gc2.get_int('N'));
+    ASSERT_EQUALS_V(12, gc2.get_int('*'));
+
+    // more words than fit still keeps the checksum, and the command is an error rather than run without them
+    Gcode gc3("N7 G1 A1 B2 C3 D4 E5 F6 H7 I8 J9 K10 L11 O12 P13 Q14 R15 S16 U17*99", nullptr, false);
+    ASSERT_TRUE(gc3.has_g);
+    ASSERT_EQUALS_V(7, gc3.get_int('N'));
+    ASSERT_EQUALS_V(99, gc3.get_int('*'));
+    ASSERT_TRUE(!gc3.has_letter('U'));
+    ASSERT_TRUE(gc3.is_error);
+    ASSERT_TRUE(!gc1.is_error);
+    ASSERT_TRUE(!gc2.is_error);
+}
+
+TEST(GCodeTest,long_text)
+{
+    // text longer than GCODE_MAX_LENGTH is kept whole
+    std::string path("/sd/");
+    while(path.size() < 3 * GCODE_MAX_LENGTH) path += "a_long_directory_name/";
+    path += "file.gcode";
+
+    Gcode gc1("M23 " + path, nullptr);
+    ASSERT_TRUE(!gc1.is_error);
+    ASSERT_EQUALS_V(23, gc1.m);
+    ASSERT_TRUE(std::string(gc1.get_command()) == " " + path);
+
+    std::string line("G1 X1 Y2 ;");
+    while(line.size() < 2 * GCODE_MAX_LENGTH) line += " comment";
+    line += " Z3";
+    Gcode gc2(line, nullptr);
+    ASSERT_TRUE(!gc2.is_error);
+    ASSERT_EQUALS_V(3, gc2.get_int('Z'));
+}
+
+TEST(GCodeTest,tokenized)
+{
+    // a tokenized command gives exactly the same values as the text it came from
+    Gcode gc1("G1 X12.345 Y-0.001 E3", nullptr);
+    Gcode gc2(nullptr);
+    gc2.has_g= true;
+    gc2.g= 1;
+    ASSERT_TRUE(gc2.add_word('X', true, Gcode::decimal_to_float(12345, -3)));
+    ASSERT_TRUE(gc2.add_word('Y', true, Gcode::decimal_to_float(-1, -3)));
+    ASSERT_TRUE(gc2.add_word('E', true, Gcode::decimal_to_float(3, 0)));
+    ASSERT_TRUE(gc2.has_g);
+    ASSERT_EQUALS_V(1, gc2.g);
+    ASSERT_EQUALS_V(3, gc2.get_num_args());
+    ASSERT_TRUE(gc1.get_value('X') == gc2.get_value('X'));
+    ASSERT_TRUE(gc1.get_value('Y') == gc2.get_value('Y'));
+    ASSERT_EQUALS_V(3, gc2.get_int('E'));
+    ASSERT_TRUE(strcmp(gc2.get_command(), "") == 0);
+
+    // letter with no value
+    ASSERT_TRUE(gc2.add_word('Z', false, 0));
+    ASSERT_TRUE(gc2.has_letter('Z'));
+    ASSERT_EQUALS_V(0, gc2.get_value('Z'));
+}
@@ -45,3 +45,39 @@ TEST(UtilsTest,append_parameters)
     ASSERT_TRUE(n == 24);
     ASSERT_TRUE(strcmp(buf, "X1.0000 Y2.0000 Z3.0000 ") == 0);
 }
+
+TEST(UtilsTest,format_float)
+{
+    char buf[32];
+    char ref[32];
+    const float values[]= {0, -0.00001F, 1.23456F, -123.45678F, 0.125F, 2.5F, 99999.99999F, 4294967296.0F};
+
+    for(float v : values) {
+        for (int d = 0; d <= 6; ++d) {
+            int n= format_float(buf, sizeof(buf), v, d);
+            snprintf(ref, sizeof(ref), "%1.*f", d, v);
+            ASSERT_EQUALS_V((int)strlen(ref), n);
+            ASSERT_TRUE(strcmp(buf, ref) == 0);
+        }
+    }
+
+    const float pos[]= {1, -2.5F, 3};
+    int n= format_floats(buf, sizeof(buf), pos, 3);
+    ASSERT_TRUE(strcmp(buf, "1.0000,-2.5000,3.0000") == 0);
+    ASSERT_EQUALS_V(21, n);
+
+    format_floats(buf, sizeof(buf), pos, 3, "XYZ", 1);
+    ASSERT_TRUE(strcmp(buf, "X:1.0 Y:-2.5 Z:3.0") == 0);
+}
+
+TEST(UtilsTest,crc32)
+{
+    const uint8_t *s= (const uint8_t *)"123456789";
+    ASSERT_TRUE(crc32(s, 9) == 0xCBF43926UL);
+    ASSERT_TRUE(crc32(s, 0) == 0);
+
+    // continued over several pieces is the same as in one go
+    uint32_t crc= crc32(s, 4);
+    crc= crc32(s + 4, 5, crc);
+    ASSERT_TRUE(crc == 0xCBF43926UL);
+}